@@ -0,0 +1,295 @@
+#include "memory_manager.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "common_defs.h"
+
+// Benchmark of the memory manager against glibc malloc. Every run keeps a live set of
+// blocks per thread and replaces one block per operation: a free picked by the free
+// order followed by an allocation drawn from the size distribution. Each operation is
+// timed for the latency percentiles; ops/sec comes from the wall time between the
+// barriers that start and stop all threads together. MEM_BITMAP_KERNEL=scalar runs
+// mem_bitmap without its SIMD search, and --lock puts the pools behind another kind
+// of lock, for comparison.
+
+#define BENCH_MAX_THREADS 64
+#define BENCH_MAX_SIZE 4096
+
+enum bench_sizes { SIZES_FIXED, SIZES_UNIFORM, SIZES_POWER_LAW };
+enum bench_order { ORDER_LIFO, ORDER_FIFO, ORDER_RANDOM };
+
+static const char *size_names[] = {"fixed", "uniform", "power_law"};
+static const char *order_names[] = {"lifo", "fifo", "random"};
+static const char *lock_names[] = {"pthread", "ticket", "mcs", "adaptive"};
+
+static enum mem_lock_kind bench_lock = MEM_LOCK_PTHREAD;
+
+typedef struct {
+    const char *name;
+    mem_pool_t *pool;
+} bench_allocator;
+
+typedef struct {
+    enum bench_sizes sizes;
+    enum bench_order order;
+    size_t live;
+    size_t ops;
+    int threads;
+} bench_config;
+
+typedef struct {
+    bench_allocator *allocator;
+    const bench_config *config;
+    my_barrier_t *barrier;
+    uint64_t seed;
+    uint32_t *latencies; // One per operation, in nanoseconds
+    size_t failures;
+    pthread_t thread;
+} bench_worker;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Draws a request size: 64 bytes, uniform in [16, 1024], or power-law distributed
+// from 16 bytes with a density falling off as size^-1.5, capped at BENCH_MAX_SIZE
+static size_t draw_size(enum bench_sizes sizes, uint64_t *rng) {
+    switch (sizes) {
+    case SIZES_FIXED:
+        return 64;
+    case SIZES_UNIFORM:
+        return 16 + xorshift(rng) % 1009;
+    default: {
+        double u = ((xorshift(rng) >> 11) + 1) * (1.0 / 9007199254740992.0);
+        double size = 16.0 / (u * u);
+        return (size < BENCH_MAX_SIZE) ? (size_t)size : BENCH_MAX_SIZE;
+    }
+    }
+}
+
+static void *bench_alloc(bench_allocator *allocator, size_t size) {
+    return allocator->pool ? mem_pool_alloc(allocator->pool, size) : malloc(size);
+}
+
+static void bench_free(bench_allocator *allocator, void *ptr) {
+    if (allocator->pool) {
+        mem_pool_free(allocator->pool, ptr);
+    } else {
+        free(ptr);
+    }
+}
+
+// Slot of the live set to free next. LIFO frees the newest block and FIFO the oldest,
+// so the live set is a stack or a ring of the same slots; random picks any slot.
+static size_t pick_slot(const bench_config *config, size_t op, uint64_t *rng) {
+    switch (config->order) {
+    case ORDER_LIFO:
+        return config->live - 1;
+    case ORDER_FIFO:
+        return op % config->live;
+    default:
+        return xorshift(rng) % config->live;
+    }
+}
+
+static void *bench_thread(void *arg) {
+    bench_worker *worker = arg;
+    const bench_config *config = worker->config;
+    uint64_t rng = worker->seed;
+    void **live = calloc(config->live, sizeof(void *));
+
+    for (size_t i = 0; i < config->live; i++) {
+        live[i] = bench_alloc(worker->allocator, draw_size(config->sizes, &rng));
+    }
+    my_barrier_wait(worker->barrier); // Start
+    for (size_t op = 0; op < config->ops; op++) {
+        size_t slot = pick_slot(config, op, &rng);
+        size_t size = draw_size(config->sizes, &rng);
+        uint64_t start = now_ns();
+        if (live[slot]) {
+            bench_free(worker->allocator, live[slot]);
+        }
+        live[slot] = bench_alloc(worker->allocator, size);
+        if (live[slot]) {
+            *(char *)live[slot] = (char)op; // Touch the block as a real caller would
+        }
+        uint64_t elapsed = now_ns() - start;
+        worker->latencies[op] = (elapsed < UINT32_MAX) ? elapsed : UINT32_MAX;
+        if (!live[slot]) {
+            worker->failures++;
+        }
+    }
+    my_barrier_wait(worker->barrier); // Stop
+
+    for (size_t i = 0; i < config->live; i++) {
+        if (live[i]) {
+            bench_free(worker->allocator, live[i]);
+        }
+    }
+    free(live);
+    return NULL;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const uint32_t *sorted, size_t count, double p) {
+    size_t rank = (size_t)(p * (count - 1));
+    return sorted[rank];
+}
+
+// Pools get room for every thread's live set at the largest size, twice over for
+// buddy rounding; the mmap backing only commits what is touched
+static mem_pool_t *bench_pool_create(const char *name, const bench_config *config) {
+    struct mem_pool_options options = {.backing = MEM_BACKING_MMAP, .lock = bench_lock};
+    if (strcmp(name, "mem_buddy") == 0) {
+        options.backend = MEM_BACKEND_BUDDY;
+    } else if (strcmp(name, "mem_bitmap") == 0) {
+        options.backend = MEM_BACKEND_BITMAP;
+    } else if (strcmp(name, "mem_sharded") == 0) {
+        options.shards = config->threads;
+    }
+    size_t size = (size_t)config->threads * config->live * BENCH_MAX_SIZE * 2;
+    mem_pool_t *pool = mem_pool_create_ex(size, &options);
+    if (pool && strcmp(name, "mem_tcache") == 0) {
+        mem_pool_set_thread_cache(pool, 64);
+    }
+    return pool;
+}
+
+static void run_config(const char *name, const bench_config *config, const char *format, bool *first) {
+    bench_allocator allocator = {name, NULL};
+    if (strcmp(name, "malloc") != 0 && !(allocator.pool = bench_pool_create(name, config))) {
+        fprintf(stderr, "cannot create a pool for %s\n", name);
+        return;
+    }
+    my_barrier_t barrier;
+    my_barrier_init(&barrier, config->threads + 1);
+    bench_worker workers[BENCH_MAX_THREADS];
+    uint32_t *latencies = malloc(config->threads * config->ops * sizeof(uint32_t));
+    for (int t = 0; t < config->threads; t++) {
+        workers[t] = (bench_worker){&allocator, config, &barrier, 0x9e3779b97f4a7c15ULL * (t + 1), latencies + t * config->ops, 0, 0};
+        pthread_create(&workers[t].thread, NULL, bench_thread, &workers[t]);
+    }
+    my_barrier_wait(&barrier);
+    uint64_t start = now_ns();
+    my_barrier_wait(&barrier);
+    double seconds = (now_ns() - start) / 1e9;
+
+    size_t failures = 0;
+    for (int t = 0; t < config->threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        failures += workers[t].failures;
+    }
+    size_t total = config->threads * config->ops;
+    qsort(latencies, total, sizeof(uint32_t), compare_u32);
+    double ops_per_sec = seconds > 0 ? total / seconds : 0;
+    uint32_t p50 = percentile(latencies, total, 0.50);
+    uint32_t p99 = percentile(latencies, total, 0.99);
+    uint32_t p999 = percentile(latencies, total, 0.999);
+
+    if (strcmp(format, "json") == 0) {
+        printf("%s  {\"allocator\": \"%s\", \"sizes\": \"%s\", \"live\": %zu, \"order\": \"%s\", \"threads\": %d, "
+               "\"ops\": %zu, \"seconds\": %.6f, \"ops_per_sec\": %.0f, \"p50_ns\": %u, \"p99_ns\": %u, \"p999_ns\": %u, \"failures\": %zu}",
+               *first ? "" : ",\n", name, size_names[config->sizes], config->live, order_names[config->order], config->threads,
+               total, seconds, ops_per_sec, p50, p99, p999, failures);
+    } else {
+        printf("%s,%s,%zu,%s,%d,%zu,%.6f,%.0f,%u,%u,%u,%zu\n", name, size_names[config->sizes], config->live,
+               order_names[config->order], config->threads, total, seconds, ops_per_sec, p50, p99, p999, failures);
+    }
+    *first = false;
+    fflush(stdout);
+
+    free(latencies);
+    my_barrier_destroy(&barrier);
+    if (allocator.pool) {
+        mem_pool_destroy(allocator.pool);
+    }
+}
+
+static void usage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --format csv|json   Output format (default csv)\n");
+    printf("  --ops N             Operations per thread and run (default 20000)\n");
+    printf("  --max-threads N     Largest thread count of the 1, 2, 4, ... sweep (default 4)\n");
+    printf("  --allocator NAME    Only run mem, mem_tcache, mem_buddy, mem_bitmap, mem_sharded or malloc\n");
+    printf("  --lock KIND         Lock of the pools: pthread (default), ticket, mcs or adaptive\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *format = "csv";
+    const char *only = NULL;
+    size_t ops = 20000;
+    int max_threads = 4;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            format = argv[++i];
+        } else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+            ops = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--max-threads") == 0 && i + 1 < argc) {
+            max_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--allocator") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else if (strcmp(argv[i], "--lock") == 0 && i + 1 < argc) {
+            const char *name = argv[++i];
+            int kind = MEM_LOCK_PTHREAD;
+            while (kind <= MEM_LOCK_ADAPTIVE && strcmp(name, lock_names[kind]) != 0) {
+                kind++;
+            }
+            if (kind > MEM_LOCK_ADAPTIVE) {
+                usage(argv[0]);
+                return 1;
+            }
+            bench_lock = kind;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (ops == 0 || max_threads < 1 || max_threads > BENCH_MAX_THREADS) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *allocators[] = {"mem", "mem_tcache", "mem_buddy", "mem_bitmap", "mem_sharded", "malloc"};
+    const size_t live_sets[] = {64, 4096};
+    bool first = true;
+    if (strcmp(format, "json") == 0) {
+        printf("[\n");
+    } else {
+        printf("allocator,sizes,live,order,threads,ops,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns,failures\n");
+    }
+    for (size_t a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++) {
+        if (only && strcmp(only, allocators[a]) != 0) {
+            continue;
+        }
+        for (int sizes = SIZES_FIXED; sizes <= SIZES_POWER_LAW; sizes++) {
+            for (size_t l = 0; l < sizeof(live_sets) / sizeof(live_sets[0]); l++) {
+                for (int order = ORDER_LIFO; order <= ORDER_RANDOM; order++) {
+                    for (int threads = 1; threads <= max_threads; threads *= 2) {
+                        bench_config config = {sizes, order, live_sets[l], ops, threads};
+                        run_config(allocators[a], &config, format, &first);
+                    }
+                }
+            }
+        }
+    }
+    if (strcmp(format, "json") == 0) {
+        printf("\n]\n");
+    }
+    return 0;
+}
@@ -1,21 +1,45 @@
 #include "linked_list.h"
 
-pthread_mutex_t list_mutex;
+mem_lock_t *list_lock;
 
-// Initialization function
-void list_init(Node** head, size_t size) {
-    mem_init(size);
+// Nodes come from a pool of their own so the list does not reset the default pool
+mem_pool_t *list_pool;
+
+// Initialization function: Returns false if the pool for the nodes cannot be created
+bool list_init(Node** head, size_t size) {
+    return list_init_ex(head, size, MEM_LOCK_PTHREAD);
+}
+
+// Initialization function: as list_init, with the given kind of lock guarding the list
+bool list_init_ex(Node** head, size_t size, enum mem_lock_kind lock) {
     *head = NULL;
-    pthread_mutex_init(&list_mutex, NULL);
+    list_pool = mem_pool_create(size);
+    if (list_pool == NULL) {
+        fprintf(stderr, "Failed to create the memory pool for the list.\n");
+        return false;
+    }
+    list_lock = mem_lock_create(lock);
+    if (list_lock == NULL) {
+        fprintf(stderr, "Failed to create the lock for the list.\n");
+        mem_pool_destroy(list_pool);
+        list_pool = NULL;
+        return false;
+    }
+    return true;
+}
+
+// Statistics: acquisitions of the list's lock and the time spent waiting for it
+void list_lock_stats(struct mem_lock_stats *stats) {
+    mem_lock_stats(list_lock, stats);
 }
 
 // Insertion function: Adds a new node with the specified data to the linked list
 void list_insert(Node** head, uint16_t data) {
-    pthread_mutex_lock(&list_mutex);
-    Node* new_node = (Node*)mem_alloc(sizeof(Node));
+    mem_lock_acquire(list_lock);
+    Node* new_node = (Node*)mem_pool_alloc(list_pool, sizeof(Node));
     if (new_node == NULL) {
         fprintf(stderr, "Failed to allocate memory for new node.\n");
-        pthread_mutex_unlock(&list_mutex);
+        mem_lock_release(list_lock);
         return;
     }
     new_node->data = data;
@@ -30,43 +54,43 @@ void list_insert(Node** head, uint16_t data) {
         }
         current->next = new_node;
     }
-    pthread_mutex_unlock(&list_mutex);
+    mem_lock_release(list_lock);
 }
 
 // Insertion function: Inserts a new node with the specified data immediately after a given node
 void list_insert_after(Node* prev_node, uint16_t data) {
-    pthread_mutex_lock(&list_mutex);
+    mem_lock_acquire(list_lock);
     if (prev_node == NULL) {
         fprintf(stderr, "The given previous node cannot be NULL.\n");
-        pthread_mutex_unlock(&list_mutex);
+        mem_lock_release(list_lock);
         return;
     }
 
-    Node* new_node = (Node*)mem_alloc(sizeof(Node));
+    Node* new_node = (Node*)mem_pool_alloc(list_pool, sizeof(Node));
     if (new_node == NULL) {
         fprintf(stderr, "Failed to allocate memory for new node.\n");
-        pthread_mutex_unlock(&list_mutex);
+        mem_lock_release(list_lock);
         return;
     }
     new_node->data = data;
     new_node->next = prev_node->next;
     prev_node->next = new_node;
-    pthread_mutex_unlock(&list_mutex);
+    mem_lock_release(list_lock);
 }
 
 // Insertion function: Inserts a new node with the specified data immediately before a given node
 void list_insert_before(Node** head, Node* next_node, uint16_t data) {
-    pthread_mutex_lock(&list_mutex);
+    mem_lock_acquire(list_lock);
     if (next_node == NULL) {
         fprintf(stderr, "The given next node cannot be NULL.\n");
-        pthread_mutex_unlock(&list_mutex);
+        mem_lock_release(list_lock);
         return;
     }
 
-    Node* new_node = (Node*)mem_alloc(sizeof(Node));
+    Node* new_node = (Node*)mem_pool_alloc(list_pool, sizeof(Node));
     if (new_node == NULL) {
         fprintf(stderr, "Failed to allocate memory for new node.\n");
-        pthread_mutex_unlock(&list_mutex);
+        mem_lock_release(list_lock);
         return;
     }
     new_node->data = data;
@@ -74,7 +98,7 @@ void list_insert_before(Node** head, Node* next_node, uint16_t data) {
     if (*head == next_node) {
         new_node->next = *head;
         *head = new_node;
-        pthread_mutex_unlock(&list_mutex);
+        mem_lock_release(list_lock);
         return;
     }
 
@@ -85,22 +109,22 @@ void list_insert_before(Node** head, Node* next_node, uint16_t data) {
 
     if (current == NULL) {
         fprintf(stderr, "The given next node is not present in the list.\n");
-        mem_free(new_node);
-        pthread_mutex_unlock(&list_mutex);
+        mem_pool_free(list_pool, new_node);
+        mem_lock_release(list_lock);
         return;
     }
 
     new_node->next = next_node;
     current->next = new_node;
-    pthread_mutex_unlock(&list_mutex);
+    mem_lock_release(list_lock);
 }
 
 // Deletion function: Removes a node with the specified data from the linked list
 void list_delete(Node** head, uint16_t data) {
-    pthread_mutex_lock(&list_mutex);
+    mem_lock_acquire(list_lock);
     if (*head == NULL) {
         fprintf(stderr, "The list is empty.\n");
-        pthread_mutex_unlock(&list_mutex);
+        mem_lock_release(list_lock);
         return;
     }
 
@@ -114,7 +138,7 @@ void list_delete(Node** head, uint16_t data) {
 
     if (current == NULL) {
         fprintf(stderr, "Node with data %u not found.\n", data);
-        pthread_mutex_unlock(&list_mutex);
+        mem_lock_release(list_lock);
         return;
     }
 
@@ -124,28 +148,28 @@ void list_delete(Node** head, uint16_t data) {
         prev->next = current->next;
     }
 
-    mem_free(current);
-    pthread_mutex_unlock(&list_mutex);
+    mem_pool_free(list_pool, current);
+    mem_lock_release(list_lock);
 }
 
 // Search function: Searches for a node with the specified data and returns a pointer to it
 Node* list_search(Node** head, uint16_t data) {
-    pthread_mutex_lock(&list_mutex);
+    mem_lock_acquire(list_lock);
     Node* current = *head;
     while (current != NULL) {
         if (current->data == data) {
-            pthread_mutex_unlock(&list_mutex);
+            mem_lock_release(list_lock);
             return current;
         }
         current = current->next;
     }
-    pthread_mutex_unlock(&list_mutex);
+    mem_lock_release(list_lock);
     return NULL;
 }
 
 // Display function: Prints all the elements in the linked list
 void list_display(Node** head) {
-    pthread_mutex_lock(&list_mutex);
+    mem_lock_acquire(list_lock);
     Node* current = *head;
     printf("[");
     while (current != NULL) {
@@ -156,12 +180,12 @@ void list_display(Node** head) {
         }
     }
     printf("]");
-    pthread_mutex_unlock(&list_mutex);
+    mem_lock_release(list_lock);
 }
 
 // Display function: Prints all elements of the list between two nodes
 void list_display_range(Node** head, Node* start_node, Node* end_node) {
-    pthread_mutex_lock(&list_mutex);
+    mem_lock_acquire(list_lock);
     Node* current = *head;
     bool in_range = (start_node == NULL);
 
@@ -182,25 +206,27 @@ void list_display_range(Node** head, Node* start_node, Node* end_node) {
         current = current->next;
     }
     printf("]");
-    pthread_mutex_unlock(&list_mutex);
+    mem_lock_release(list_lock);
 }
 
 // Nodes count function: Returns the count of nodes
 int list_count_nodes(Node** head) {
-    pthread_mutex_lock(&list_mutex);
+    mem_lock_acquire(list_lock);
     int count = 0;
     Node* current = *head;
     while (current != NULL) {
         count++;
         current = current->next;
     }
-    pthread_mutex_unlock(&list_mutex);
+    mem_lock_release(list_lock);
     return count;
 }
 
 // Cleanup function: Frees all the nodes in the linked list
 void list_cleanup(Node** head) {
     *head = NULL;
-    mem_deinit();
-    pthread_mutex_destroy(&list_mutex);
+    mem_pool_destroy(list_pool);
+    list_pool = NULL;
+    mem_lock_destroy(list_lock);
+    list_lock = NULL;
 }
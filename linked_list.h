@@ -14,7 +14,11 @@ typedef struct Node {
     uint16_t data; // Stores the data as an unsigned 16-bit integer
 } Node;
 
-void list_init(Node** head, size_t size);
+bool list_init(Node** head, size_t size);
+
+bool list_init_ex(Node** head, size_t size, enum mem_lock_kind lock);
+
+void list_lock_stats(struct mem_lock_stats *stats);
 
 void list_insert(Node** head, uint16_t data);
 
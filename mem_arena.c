@@ -0,0 +1,130 @@
+#include "memory_manager.h"
+#include "memory_manager_internal.h"
+#include <stdint.h>
+
+// An arena is a list of chunks, each one pool block, bumped from front to back.
+// Objects carry no header and are never freed on their own: mem_arena_reset rewinds
+// the arena to the start of its first chunk, keeping every chunk for the next round,
+// and mem_arena_end gives the chunks back to the pool. An arena is meant for one
+// thread at a time, so it takes no locks.
+#define ARENA_MIN_CHUNK 4096
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size; // Bytes after the header
+} arena_chunk;
+
+struct mem_arena {
+    mem_pool_t *pool;
+    arena_chunk *first;
+    arena_chunk *current;
+    char *top; // Next free byte of the current chunk
+    char *end;
+    size_t next_size; // Bytes of the next chunk taken from the pool
+};
+
+static size_t round_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+static char *chunk_data(arena_chunk *chunk) {
+    return (char *)chunk + round_up(sizeof(arena_chunk), MEM_ALIGN_DEFAULT);
+}
+
+static void arena_enter(mem_arena_t *arena, arena_chunk *chunk) {
+    arena->current = chunk;
+    arena->top = chunk_data(chunk);
+    arena->end = arena->top + chunk->size;
+}
+
+static arena_chunk *chunk_new(mem_arena_t *arena, size_t size) {
+    arena_chunk *chunk = mem_pool_alloc(arena->pool, round_up(sizeof(arena_chunk), MEM_ALIGN_DEFAULT) + size);
+    if (chunk) {
+        chunk->next = NULL;
+        chunk->size = size;
+    }
+    return chunk;
+}
+
+// Moves on to the first later chunk with room for size bytes, taking a new one from
+// the pool after the current chunk if none has. Chunks double in size as they are
+// added, falling back to just size bytes when the pool has no room for the doubled one.
+static bool arena_advance(mem_arena_t *arena, size_t size) {
+    for (arena_chunk *chunk = arena->current->next; chunk != NULL; chunk = chunk->next) {
+        if (chunk->size >= size) {
+            arena_enter(arena, chunk);
+            return true;
+        }
+    }
+    size_t chunk_size = (arena->next_size > size) ? arena->next_size : round_up(size, ARENA_MIN_CHUNK);
+    arena_chunk *chunk = chunk_new(arena, chunk_size);
+    if (!chunk && chunk_size > size) {
+        chunk = chunk_new(arena, chunk_size = size);
+    }
+    if (!chunk) {
+        return false;
+    }
+    arena->next_size = chunk_size * 2;
+    chunk->next = arena->current->next;
+    arena->current->next = chunk;
+    arena_enter(arena, chunk);
+    return true;
+}
+
+// Begin function: creates an arena with a first chunk of size bytes (0 for a default)
+// carved from the given pool
+mem_arena_t *mem_pool_arena_begin(mem_pool_t *pool, size_t size) {
+    if (!pool) {
+        return NULL;
+    }
+    mem_arena_t *arena = calloc(1, sizeof(*arena));
+    if (!arena) {
+        return NULL;
+    }
+    arena->pool = pool;
+    size = round_up(size ? size : ARENA_MIN_CHUNK, MEM_ALIGN_DEFAULT);
+    arena->first = chunk_new(arena, size);
+    if (!arena->first) {
+        free(arena);
+        return NULL;
+    }
+    arena->next_size = size * 2;
+    arena_enter(arena, arena->first);
+    return arena;
+}
+
+mem_arena_t *mem_arena_begin(size_t size) {
+    return mem_pool_arena_begin(mem_default_pool(), size);
+}
+
+// Allocation function: bumps the arena by size bytes rounded up to MEM_ALIGN_DEFAULT,
+// growing it by a chunk when the current one is full
+void* mem_arena_alloc(mem_arena_t *arena, size_t size) {
+    if (size == 0 || size > SIZE_MAX / 2) {
+        return NULL;
+    }
+    size = round_up(size, MEM_ALIGN_DEFAULT);
+    if (size > (size_t)(arena->end - arena->top) && !arena_advance(arena, size)) {
+        return NULL;
+    }
+    void *ptr = arena->top;
+    arena->top += size;
+    return ptr;
+}
+
+// Reset function: frees every object of the arena at once, in constant time. The
+// chunks stay with the arena and are reused in order by the next allocations.
+void mem_arena_reset(mem_arena_t *arena) {
+    arena_enter(arena, arena->first);
+}
+
+// End function: gives every chunk back to the pool and frees the arena
+void mem_arena_end(mem_arena_t *arena) {
+    arena_chunk *chunk = arena->first;
+    while (chunk) {
+        arena_chunk *next = chunk->next;
+        mem_pool_free(arena->pool, chunk);
+        chunk = next;
+    }
+    free(arena);
+}
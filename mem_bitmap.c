@@ -0,0 +1,278 @@
+#include "memory_manager.h"
+#include "memory_manager_internal.h"
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BITMAP_X86 1
+#endif
+
+// Free-run search for bitmap pools, where bit i of the map is set while granule i is
+// free. The scalar kernel walks the map a word at a time, carrying the free granules
+// at the top of one word into the next so runs may span words; within a word the
+// starts of runs of n free granules are found by and-ing the word with itself shifted
+// right 1, 2, 4, ... granules. The SSE2 and AVX2 kernels apply the same shifts to two
+// or four words at once. The fastest kernel the CPU supports is picked when the
+// library loads; MEM_BITMAP_KERNEL=scalar or sse2 overrides the choice.
+
+typedef uint32_t (*find_run_fn)(const uint64_t *map, uint32_t words, uint32_t granules);
+
+// Bit p of the result is set where granules p to p + n - 1 of the word are free, for
+// 1 <= n <= 64
+static inline uint64_t run_starts(uint64_t word, uint32_t n) {
+    uint32_t covered = 1;
+    while (covered * 2 <= n) {
+        word &= word >> covered;
+        covered *= 2;
+    }
+    return (covered < n) ? word & (word >> (n - covered)) : word;
+}
+
+// Examines word i given the free granules carried over from the words before it.
+// Returns the first granule of a run of n free granules, or MEM_BITMAP_NONE.
+static inline uint32_t word_step(uint64_t word, uint32_t i, uint32_t n, uint32_t *carry) {
+    if (word == 0) {
+        *carry = 0;
+        return MEM_BITMAP_NONE;
+    }
+    uint32_t low = (word == ~0ULL) ? 64 : __builtin_ctzll(~word);
+    if (*carry + low >= n) {
+        return i * 64 - *carry;
+    }
+    if (n <= 64) {
+        uint64_t starts = run_starts(word, n);
+        if (starts) {
+            return i * 64 + __builtin_ctzll(starts);
+        }
+    }
+    *carry = (word == ~0ULL) ? *carry + 64 : (uint32_t)__builtin_clzll(~word);
+    return MEM_BITMAP_NONE;
+}
+
+static uint32_t find_run_scalar(const uint64_t *map, uint32_t words, uint32_t n) {
+    uint32_t carry = 0;
+    for (uint32_t i = 0; i < words; i++) {
+        uint32_t found = word_step(map[i], i, n, &carry);
+        if (found != MEM_BITMAP_NONE) {
+            return found;
+        }
+    }
+    return MEM_BITMAP_NONE;
+}
+
+#ifdef BITMAP_X86
+// The vector kernels find short runs exactly, two or four words at a time. A run of
+// n granules either lies within one word or starts in the top n - 1 granules of a
+// word and ends in the next, so besides the starts within each word they look for
+// starts in a window of those top granules joined to the low 65 - n granules of the
+// next word, taken from a load one word further on. The window holds every such run
+// while n <= VECTOR_MAX_RUN; longer runs and the words left over at the end go
+// through the scalar steps.
+#define VECTOR_MAX_RUN 33
+
+// Granule of the first hit in a block whose first word is word i, given the starts
+// within each word and within each window beginning at granule 65 - n of the word
+static uint32_t first_hit(const uint64_t *starts, const uint64_t *crossing, int lanes, uint32_t i, uint32_t n) {
+    for (int lane = 0; lane < lanes; lane++) {
+        if (starts[lane]) {
+            return (i + lane) * 64 + __builtin_ctzll(starts[lane]);
+        }
+        if (crossing[lane]) {
+            return (i + lane) * 64 + 65 - n + __builtin_ctzll(crossing[lane]);
+        }
+    }
+    return MEM_BITMAP_NONE;
+}
+
+// Scalar steps from word i on, picking up the free granules at the top of word i - 1
+static uint32_t find_run_tail(const uint64_t *map, uint32_t i, uint32_t words, uint32_t n) {
+    uint32_t carry = (i > 0 && map[i - 1] != 0) ? (uint32_t)__builtin_clzll(~map[i - 1]) : 0;
+    for (; i < words; i++) {
+        uint32_t found = word_step(map[i], i, n, &carry);
+        if (found != MEM_BITMAP_NONE) {
+            return found;
+        }
+    }
+    return MEM_BITMAP_NONE;
+}
+
+__attribute__((target("sse2")))
+static uint32_t find_run_sse2(const uint64_t *map, uint32_t words, uint32_t n) {
+    if (n > VECTOR_MAX_RUN) {
+        return find_run_scalar(map, words, n);
+    }
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i window_mask = _mm_set1_epi64x((1ULL << (n - 1)) - 1);
+    const __m128i shift_low = _mm_cvtsi32_si128(65 - n);
+    const __m128i shift_high = _mm_cvtsi32_si128(n - 1);
+    uint32_t i = 0;
+    for (; i + 3 <= words; i += 2) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(map + i));
+        __m128i next = _mm_loadu_si128((const __m128i *)(map + i + 1));
+        __m128i window = _mm_or_si128(_mm_srl_epi64(block, shift_low), _mm_sll_epi64(next, shift_high));
+        __m128i starts = block;
+        __m128i crossing = window;
+        uint32_t covered = 1;
+        while (covered * 2 <= n) {
+            __m128i shift = _mm_cvtsi32_si128(covered);
+            starts = _mm_and_si128(starts, _mm_srl_epi64(starts, shift));
+            crossing = _mm_and_si128(crossing, _mm_srl_epi64(crossing, shift));
+            covered *= 2;
+        }
+        if (covered < n) {
+            __m128i shift = _mm_cvtsi32_si128(n - covered);
+            starts = _mm_and_si128(starts, _mm_srl_epi64(starts, shift));
+            crossing = _mm_and_si128(crossing, _mm_srl_epi64(crossing, shift));
+        }
+        crossing = (n > 1) ? _mm_and_si128(crossing, window_mask) : zero;
+        __m128i hits = _mm_or_si128(starts, crossing);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(hits, zero)) != 0xffff) {
+            uint64_t lanes[2];
+            uint64_t crossing_lanes[2];
+            _mm_storeu_si128((__m128i *)lanes, starts);
+            _mm_storeu_si128((__m128i *)crossing_lanes, crossing);
+            return first_hit(lanes, crossing_lanes, 2, i, n);
+        }
+    }
+    return find_run_tail(map, i, words, n);
+}
+
+__attribute__((target("avx2")))
+static uint32_t find_run_avx2(const uint64_t *map, uint32_t words, uint32_t n) {
+    if (n > VECTOR_MAX_RUN) {
+        return find_run_scalar(map, words, n);
+    }
+    const __m256i window_mask = _mm256_set1_epi64x((1ULL << (n - 1)) - 1);
+    const __m128i shift_low = _mm_cvtsi32_si128(65 - n);
+    const __m128i shift_high = _mm_cvtsi32_si128(n - 1);
+    uint32_t i = 0;
+    for (; i + 5 <= words; i += 4) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(map + i));
+        __m256i next = _mm256_loadu_si256((const __m256i *)(map + i + 1));
+        __m256i window = _mm256_or_si256(_mm256_srl_epi64(block, shift_low), _mm256_sll_epi64(next, shift_high));
+        __m256i starts = block;
+        __m256i crossing = window;
+        uint32_t covered = 1;
+        while (covered * 2 <= n) {
+            __m128i shift = _mm_cvtsi32_si128(covered);
+            starts = _mm256_and_si256(starts, _mm256_srl_epi64(starts, shift));
+            crossing = _mm256_and_si256(crossing, _mm256_srl_epi64(crossing, shift));
+            covered *= 2;
+        }
+        if (covered < n) {
+            __m128i shift = _mm_cvtsi32_si128(n - covered);
+            starts = _mm256_and_si256(starts, _mm256_srl_epi64(starts, shift));
+            crossing = _mm256_and_si256(crossing, _mm256_srl_epi64(crossing, shift));
+        }
+        crossing = (n > 1) ? _mm256_and_si256(crossing, window_mask) : _mm256_setzero_si256();
+        __m256i hits = _mm256_or_si256(starts, crossing);
+        if (!_mm256_testz_si256(hits, hits)) {
+            uint64_t lanes[4];
+            uint64_t crossing_lanes[4];
+            _mm256_storeu_si256((__m256i *)lanes, starts);
+            _mm256_storeu_si256((__m256i *)crossing_lanes, crossing);
+            return first_hit(lanes, crossing_lanes, 4, i, n);
+        }
+    }
+    return find_run_tail(map, i, words, n);
+}
+#endif
+
+static find_run_fn find_run = find_run_scalar;
+static enum mem_bitmap_kernel current_kernel = MEM_BITMAP_SCALAR;
+
+// Switches to the given kernel if the CPU supports it, returning false otherwise
+bool mem_bitmap_set_kernel(enum mem_bitmap_kernel kernel) {
+    switch (kernel) {
+    case MEM_BITMAP_SCALAR:
+        find_run = find_run_scalar;
+        break;
+#ifdef BITMAP_X86
+    case MEM_BITMAP_SSE2:
+        if (!__builtin_cpu_supports("sse2")) {
+            return false;
+        }
+        find_run = find_run_sse2;
+        break;
+    case MEM_BITMAP_AVX2:
+        if (!__builtin_cpu_supports("avx2")) {
+            return false;
+        }
+        find_run = find_run_avx2;
+        break;
+#endif
+    default:
+        return false;
+    }
+    current_kernel = kernel;
+    return true;
+}
+
+enum mem_bitmap_kernel mem_bitmap_kernel() {
+    return current_kernel;
+}
+
+__attribute__((constructor))
+static void bitmap_pick_kernel() {
+#ifdef BITMAP_X86
+    __builtin_cpu_init();
+#endif
+    const char *name = getenv("MEM_BITMAP_KERNEL");
+    if (name && strcmp(name, "scalar") == 0) {
+        mem_bitmap_set_kernel(MEM_BITMAP_SCALAR);
+    } else if (name && strcmp(name, "sse2") == 0) {
+        mem_bitmap_set_kernel(MEM_BITMAP_SSE2);
+    } else if (!mem_bitmap_set_kernel(MEM_BITMAP_AVX2)) {
+        mem_bitmap_set_kernel(MEM_BITMAP_SSE2);
+    }
+}
+
+// First granule of the lowest run of n free granules, or MEM_BITMAP_NONE if there is none
+uint32_t mem_bitmap_find_run(const uint64_t *map, uint32_t words, uint32_t n) {
+    return (n == 0) ? MEM_BITMAP_NONE : find_run(map, words, n);
+}
+
+// Length of the longest run of free granules
+uint32_t mem_bitmap_longest_run(const uint64_t *map, uint32_t words) {
+    uint32_t longest = 0;
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < words; i++) {
+        uint64_t word = map[i];
+        if (word == ~0ULL) {
+            run += 64;
+            continue;
+        }
+        uint32_t pos = 0;
+        while (pos < 64) {
+            uint64_t rest = word >> pos;
+            if (rest & 1) {
+                uint32_t ones = __builtin_ctzll(~rest);
+                run += ones;
+                pos += ones;
+            } else {
+                longest = (run > longest) ? run : longest;
+                run = 0;
+                if (rest == 0) {
+                    break;
+                }
+                pos += __builtin_ctzll(rest);
+            }
+        }
+    }
+    return (run > longest) ? run : longest;
+}
+
+// Sets or clears the bits of granules [index, index + count)
+void mem_bitmap_fill(uint64_t *map, uint32_t index, uint32_t count, bool set) {
+    while (count > 0) {
+        uint32_t bit = index % 64;
+        uint32_t span = (count < 64 - bit) ? count : 64 - bit;
+        uint64_t mask = (span == 64) ? ~0ULL : ((1ULL << span) - 1) << bit;
+        if (set) {
+            map[index / 64] |= mask;
+        } else {
+            map[index / 64] &= ~mask;
+        }
+        index += span;
+        count -= span;
+    }
+}
@@ -0,0 +1,225 @@
+#include "memory_manager.h"
+#include "memory_manager_internal.h"
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Locks behind the pools and the linked list, picked per lock at init. Every kind
+// first tries to take the lock outright and times the wait only when it is held, so
+// the statistics cost nothing on an uncontended lock; the holder updates them after
+// acquiring, which keeps them consistent under the lock itself.
+//
+// Spinning waiters pause between reads and yield the CPU every SPIN_YIELD_EVERY
+// spins, so that a holder preempted on an oversubscribed machine gets to run. With
+// one CPU the holder never runs while anyone spins, so waiters yield at once.
+#define SPIN_YIELD_EVERY 1024
+#define ADAPTIVE_MIN_SPINS 16
+#define ADAPTIVE_MAX_SPINS 4096
+
+static uint32_t spins_per_yield = SPIN_YIELD_EVERY;
+
+__attribute__((constructor))
+static void lock_count_cpus() {
+    if (sysconf(_SC_NPROCESSORS_ONLN) == 1) {
+        spins_per_yield = 1;
+    }
+}
+
+static uint64_t lock_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void spin_pause(uint32_t *spins) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+    if (++*spins % spins_per_yield == 0) {
+        sched_yield();
+    }
+}
+
+static bool word_try_take(uint32_t *word, uint32_t value) {
+    uint32_t expected = 0;
+    return __atomic_compare_exchange_n(word, &expected, value, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static void futex_wait(uint32_t *word, uint32_t value) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake_one(uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+void mem_lock_init(struct mem_lock *lock, enum mem_lock_kind kind) {
+    memset(lock, 0, sizeof(*lock));
+    lock->kind = kind;
+    if (kind == MEM_LOCK_PTHREAD) {
+        pthread_mutex_init(&lock->mutex, NULL);
+    }
+}
+
+// Takes the lock when it is free, returning false if the caller has to wait; a ticket
+// or MCS waiter has taken its place in the queue by then
+static bool lock_try_fast(struct mem_lock *lock, uint32_t *ticket, struct mem_lock_waiter *self) {
+    switch (lock->kind) {
+    case MEM_LOCK_TICKET:
+        *ticket = __atomic_fetch_add(&lock->next_ticket, 1, __ATOMIC_RELAXED);
+        return __atomic_load_n(&lock->word, __ATOMIC_ACQUIRE) == *ticket;
+    case MEM_LOCK_MCS: {
+        struct mem_lock_waiter *ahead = __atomic_exchange_n(&lock->queue, self, __ATOMIC_ACQ_REL);
+        if (ahead) {
+            __atomic_store_n(&ahead->next, self, __ATOMIC_RELEASE);
+        }
+        return ahead == NULL;
+    }
+    case MEM_LOCK_ADAPTIVE:
+        return word_try_take(&lock->word, 1);
+    default:
+        return pthread_mutex_trylock(&lock->mutex) == 0;
+    }
+}
+
+// MCS waiters queue up on entries on their own stacks, each spinning on its own entry
+// until the holder ahead hands it the lock on release, so the lock goes strictly in
+// arrival order. An entry has to outlive the wait only: the new holder moves to the
+// entry inside the lock, so a thread may hold any number of these locks.
+static void mcs_wait(struct mem_lock_waiter *self) {
+    uint32_t spins = 0;
+    while (!__atomic_load_n(&self->granted, __ATOMIC_ACQUIRE)) {
+        spin_pause(&spins);
+    }
+}
+
+static void mcs_settle(struct mem_lock *lock, struct mem_lock_waiter *self) {
+    // The holder ahead has seen the last write to this entry before handing the lock on
+    __atomic_store_n(&lock->holder.next, NULL, __ATOMIC_RELAXED);
+    struct mem_lock_waiter *expected = self;
+    if (__atomic_compare_exchange_n(&lock->queue, &expected, &lock->holder, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return;
+    }
+    struct mem_lock_waiter *next;
+    uint32_t spins = 0;
+    while (!(next = __atomic_load_n(&self->next, __ATOMIC_ACQUIRE))) {
+        spin_pause(&spins); // A waiter has joined but not yet linked itself in
+    }
+    __atomic_store_n(&lock->holder.next, next, __ATOMIC_RELAXED);
+}
+
+static void mcs_release(struct mem_lock *lock) {
+    struct mem_lock_waiter *next = __atomic_load_n(&lock->holder.next, __ATOMIC_ACQUIRE);
+    if (!next) {
+        struct mem_lock_waiter *expected = &lock->holder;
+        if (__atomic_compare_exchange_n(&lock->queue, &expected, NULL, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        uint32_t spins = 0;
+        while (!(next = __atomic_load_n(&lock->holder.next, __ATOMIC_ACQUIRE))) {
+            spin_pause(&spins);
+        }
+    }
+    __atomic_store_n(&next->granted, 1, __ATOMIC_RELEASE);
+}
+
+// Spins for up to twice the spins that recently won the lock, tracked as a moving
+// average like glibc's adaptive mutexes, then sleeps on the lock word, which is 2
+// while anyone may be sleeping so the release knows to wake one
+static void adaptive_wait(struct mem_lock *lock) {
+    uint32_t estimate = __atomic_load_n(&lock->spin_estimate, __ATOMIC_RELAXED);
+    uint32_t limit = estimate * 2 + ADAPTIVE_MIN_SPINS;
+    limit = (limit < ADAPTIVE_MAX_SPINS) ? limit : ADAPTIVE_MAX_SPINS;
+    uint32_t spins = 0;
+    bool taken = false;
+    while (!taken && spins < limit) {
+        spin_pause(&spins);
+        taken = __atomic_load_n(&lock->word, __ATOMIC_RELAXED) == 0 && word_try_take(&lock->word, 1);
+    }
+    if (!taken) {
+        while (__atomic_exchange_n(&lock->word, 2, __ATOMIC_ACQUIRE) != 0) {
+            futex_wait(&lock->word, 2);
+        }
+    }
+    // Holding the lock now, the only writer of the estimate
+    __atomic_store_n(&lock->spin_estimate, estimate + ((int32_t)spins - (int32_t)estimate) / 8, __ATOMIC_RELAXED);
+}
+
+void mem_lock_acquire(struct mem_lock *lock) {
+    uint32_t ticket = 0;
+    struct mem_lock_waiter self = {NULL, 0};
+    if (!lock_try_fast(lock, &ticket, &self)) {
+        uint64_t start = lock_now_ns();
+        uint32_t spins = 0;
+        switch (lock->kind) {
+        case MEM_LOCK_TICKET:
+            while (__atomic_load_n(&lock->word, __ATOMIC_ACQUIRE) != ticket) {
+                spin_pause(&spins);
+            }
+            break;
+        case MEM_LOCK_MCS:
+            mcs_wait(&self);
+            break;
+        case MEM_LOCK_ADAPTIVE:
+            adaptive_wait(lock);
+            break;
+        default:
+            pthread_mutex_lock(&lock->mutex);
+            break;
+        }
+        lock->stats.contentions++;
+        lock->stats.wait_ns += lock_now_ns() - start;
+    }
+    if (lock->kind == MEM_LOCK_MCS) {
+        mcs_settle(lock, &self);
+    }
+    lock->stats.acquires++;
+}
+
+void mem_lock_release(struct mem_lock *lock) {
+    switch (lock->kind) {
+    case MEM_LOCK_TICKET:
+        __atomic_store_n(&lock->word, lock->word + 1, __ATOMIC_RELEASE);
+        break;
+    case MEM_LOCK_MCS:
+        mcs_release(lock);
+        break;
+    case MEM_LOCK_ADAPTIVE:
+        if (__atomic_exchange_n(&lock->word, 0, __ATOMIC_RELEASE) == 2) {
+            futex_wake_one(&lock->word);
+        }
+        break;
+    default:
+        pthread_mutex_unlock(&lock->mutex);
+        break;
+    }
+}
+
+void mem_lock_deinit(struct mem_lock *lock) {
+    if (lock->kind == MEM_LOCK_PTHREAD) {
+        pthread_mutex_destroy(&lock->mutex);
+    }
+}
+
+mem_lock_t *mem_lock_create(enum mem_lock_kind kind) {
+    mem_lock_t *lock = malloc(sizeof(*lock));
+    if (!lock) {
+        return NULL;
+    }
+    mem_lock_init(lock, kind);
+    return lock;
+}
+
+void mem_lock_stats(mem_lock_t *lock, struct mem_lock_stats *stats) {
+    mem_lock_acquire(lock);
+    *stats = lock->stats;
+    mem_lock_release(lock);
+}
+
+void mem_lock_destroy(mem_lock_t *lock) {
+    mem_lock_deinit(lock);
+    free(lock);
+}
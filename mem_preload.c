@@ -0,0 +1,190 @@
+#include "memory_manager.h"
+#include "memory_manager_internal.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <unistd.h>
+
+// Interposer for running unmodified programs on the pool allocator:
+//
+//     LD_PRELOAD=./libmemory_manager_preload.so program
+//
+// The standard allocation functions are served from one sharded, mmap-backed pool
+// that is created on the first call. MEM_PRELOAD_SIZE sets its size in bytes (4 GB
+// of address space by default, committed as it is touched) and MEM_PRELOAD_SHARDS
+// its shard count (one per CPU by default); no single block can exceed a shard.
+//
+// Creating the pool allocates itself, so calls made while it is being set up are
+// served from a static bootstrap arena whose blocks are never freed.
+#define PRELOAD_DEFAULT_SIZE ((size_t)4 << 30)
+#define PRELOAD_MAX_SHARDS 64
+#define BOOTSTRAP_SIZE (1024 * 1024)
+#define BOOTSTRAP_HEADER 16 // Holds the block size, keeping blocks 16-byte aligned
+
+enum { POOL_NONE, POOL_CREATING, POOL_READY };
+
+static mem_pool_t *preload_pool;
+static int pool_state = POOL_NONE;
+static __thread bool creating_pool; // Set on the thread creating the pool
+
+static _Alignas(64) char bootstrap_arena[BOOTSTRAP_SIZE];
+static size_t bootstrap_used;
+
+static void *bootstrap_alloc(size_t size, size_t alignment) {
+    size_t offset;
+    size_t end;
+    do {
+        offset = __atomic_load_n(&bootstrap_used, __ATOMIC_RELAXED);
+        size_t start = (offset + BOOTSTRAP_HEADER + alignment - 1) & ~(alignment - 1);
+        end = start + ((size + 15) & ~(size_t)15);
+        if (size > BOOTSTRAP_SIZE || end > BOOTSTRAP_SIZE) {
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&bootstrap_used, &offset, end, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    char *ptr = bootstrap_arena + ((offset + BOOTSTRAP_HEADER + alignment - 1) & ~(alignment - 1));
+    *(size_t *)(ptr - sizeof(size_t)) = size;
+    return ptr;
+}
+
+static bool is_bootstrap(void *ptr) {
+    return (char *)ptr >= bootstrap_arena && (char *)ptr < bootstrap_arena + BOOTSTRAP_SIZE;
+}
+
+static size_t bootstrap_size(void *ptr) {
+    return *(size_t *)((char *)ptr - sizeof(size_t));
+}
+
+static size_t env_size(const char *name, size_t fallback) {
+    const char *value = getenv(name);
+    size_t parsed = value ? strtoull(value, NULL, 0) : 0;
+    return parsed ? parsed : fallback;
+}
+
+// Fork handlers: the child gets the pool with no lock held by a thread it lacks
+static void preload_prepare() {
+    mem_pool_lock_all(preload_pool);
+}
+
+static void preload_release() {
+    mem_pool_unlock_all(preload_pool);
+}
+
+// Returns the pool, creating it on the first call, or NULL while the calling thread
+// is the one creating it. Other threads wait for the creation to finish.
+static mem_pool_t *preload_get_pool() {
+    if (__atomic_load_n(&pool_state, __ATOMIC_ACQUIRE) == POOL_READY) {
+        return preload_pool;
+    }
+    if (creating_pool) {
+        return NULL;
+    }
+    int expected = POOL_NONE;
+    if (!__atomic_compare_exchange_n(&pool_state, &expected, POOL_CREATING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&pool_state, __ATOMIC_ACQUIRE) != POOL_READY) {
+            sched_yield();
+        }
+        return preload_pool;
+    }
+    creating_pool = true;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t shards = env_size("MEM_PRELOAD_SHARDS", (cpus > 0) ? cpus : 1);
+    struct mem_pool_options options = {
+        .backing = MEM_BACKING_MMAP,
+        .shards = (shards < PRELOAD_MAX_SHARDS) ? shards : PRELOAD_MAX_SHARDS,
+    };
+    preload_pool = mem_pool_create_ex(env_size("MEM_PRELOAD_SIZE", PRELOAD_DEFAULT_SIZE), &options);
+    if (preload_pool) {
+        pthread_atfork(preload_prepare, preload_release, preload_release);
+    }
+    __atomic_store_n(&pool_state, POOL_READY, __ATOMIC_RELEASE);
+    creating_pool = false;
+    return preload_pool;
+}
+
+static void *preload_alloc(size_t size, size_t alignment) {
+    mem_pool_t *pool = preload_get_pool();
+    size = size ? size : 1; // Every call returns a distinct pointer
+    void *ptr = pool ? mem_pool_alloc_aligned(pool, size, alignment) : bootstrap_alloc(size, alignment);
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void *malloc(size_t size) {
+    return preload_alloc(size, MEM_ALIGN_DEFAULT);
+}
+
+void free(void *ptr) {
+    if (ptr && !is_bootstrap(ptr) && preload_get_pool()) {
+        mem_pool_free(preload_pool, ptr);
+    }
+}
+
+void *calloc(size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *ptr = preload_alloc(count * size, MEM_ALIGN_DEFAULT);
+    if (ptr) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (!ptr) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (is_bootstrap(ptr) || !preload_get_pool()) {
+        void *newptr = malloc(size);
+        if (newptr && is_bootstrap(ptr)) {
+            memcpy(newptr, ptr, (bootstrap_size(ptr) < size) ? bootstrap_size(ptr) : size);
+        }
+        return newptr;
+    }
+    void *newptr = mem_pool_resize(preload_pool, ptr, size);
+    if (!newptr) {
+        errno = ENOMEM;
+    }
+    return newptr;
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) {
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *ptr = preload_alloc(size, (alignment > MEM_ALIGN_DEFAULT) ? alignment : MEM_ALIGN_DEFAULT);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *out = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return preload_alloc(size, (alignment > MEM_ALIGN_DEFAULT) ? alignment : MEM_ALIGN_DEFAULT);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    return aligned_alloc(alignment, size);
+}
+
+size_t malloc_usable_size(void *ptr) {
+    if (!ptr) {
+        return 0;
+    }
+    if (is_bootstrap(ptr)) {
+        return bootstrap_size(ptr);
+    }
+    return preload_get_pool() ? mem_pool_usable_size(preload_pool, ptr) : 0;
+}
@@ -0,0 +1,192 @@
+#include "memory_manager.h"
+#include "memory_manager_internal.h"
+#include <execinfo.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+
+// The profiler samples allocations the way tcmalloc does: each thread counts down the
+// bytes it allocates and takes a sample when the count runs out, then draws the next
+// distance from an exponential distribution with mean sample_bytes. A byte is thus
+// sampled with the same probability wherever it is, and a sample of size s stands for
+// s / (1 - exp(-s / sample_bytes)) bytes, the scaling pprof applies to heap_v2 profiles.
+#define PROFILE_DEPTH 32
+#define PROFILE_BUCKETS 1024
+
+typedef struct profile_sample {
+    void *ptr;
+    size_t size;
+    int depth;
+    void *stack[PROFILE_DEPTH];
+    struct profile_sample *next; // Next sample in the same hash bucket
+} profile_sample;
+
+struct mem_profiler {
+    size_t sample_bytes; // Mean distance between samples, 0 while sampling is stopped
+    size_t live;         // Samples in the table, read without the mutex to skip lookups
+    pthread_mutex_t mutex;
+    profile_sample *buckets[PROFILE_BUCKETS];
+};
+
+// Per-thread sampling state, shared by all profiled pools
+static __thread int64_t bytes_until_sample;
+static __thread bool sampling_started;
+static __thread uint64_t sample_rng;
+
+static uint32_t bucket_of(void *ptr) {
+    uintptr_t key = (uintptr_t)ptr >> 4;
+    return (key * 0x9e3779b97f4a7c15ULL) >> 54; // Top 10 bits for 1024 buckets
+}
+
+// Exponentially distributed distance to the next sample, with the given mean
+static int64_t next_sample_distance(size_t mean) {
+    if (sample_rng == 0) {
+        sample_rng = (uintptr_t)&sample_rng | 1;
+    }
+    sample_rng ^= sample_rng << 13;
+    sample_rng ^= sample_rng >> 7;
+    sample_rng ^= sample_rng << 17;
+    double u = ((sample_rng >> 11) + 1) * (1.0 / 9007199254740992.0); // In (0, 1]
+    return (int64_t)(-log(u) * mean) + 1;
+}
+
+static void profile_insert(mem_profiler_t *profiler, profile_sample *sample) {
+    uint32_t bucket = bucket_of(sample->ptr);
+    pthread_mutex_lock(&profiler->mutex);
+    sample->next = profiler->buckets[bucket];
+    profiler->buckets[bucket] = sample;
+    __atomic_store_n(&profiler->live, profiler->live + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&profiler->mutex);
+}
+
+// Unlinks and returns the sample of the block at ptr, or NULL if it has none. Without
+// live samples this is a single load.
+static profile_sample *profile_take(mem_profiler_t *profiler, void *ptr) {
+    if (!ptr || __atomic_load_n(&profiler->live, __ATOMIC_RELAXED) == 0) {
+        return NULL;
+    }
+    profile_sample *found = NULL;
+    pthread_mutex_lock(&profiler->mutex);
+    for (profile_sample **link = &profiler->buckets[bucket_of(ptr)]; *link != NULL; link = &(*link)->next) {
+        if ((*link)->ptr == ptr) {
+            found = *link;
+            *link = found->next;
+            __atomic_store_n(&profiler->live, profiler->live - 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&profiler->mutex);
+    return found;
+}
+
+mem_profiler_t *mem_profiler_create() {
+    mem_profiler_t *profiler = calloc(1, sizeof(*profiler));
+    if (profiler) {
+        pthread_mutex_init(&profiler->mutex, NULL);
+    }
+    return profiler;
+}
+
+void mem_profiler_set_rate(mem_profiler_t *profiler, size_t sample_bytes) {
+    __atomic_store_n(&profiler->sample_bytes, sample_bytes, __ATOMIC_RELAXED);
+}
+
+// Counts the allocation against the thread's budget and records a sample with the
+// caller's backtrace when the budget runs out
+void mem_profiler_alloc(mem_profiler_t *profiler, void *ptr, size_t size) {
+    size_t mean = __atomic_load_n(&profiler->sample_bytes, __ATOMIC_RELAXED);
+    if (mean == 0 || (bytes_until_sample -= size) > 0) {
+        return;
+    }
+    bytes_until_sample = next_sample_distance(mean);
+    if (!sampling_started) {
+        sampling_started = true; // The first countdown starts here, not at zero
+        return;
+    }
+    // Everything that may allocate happens before taking the mutex, so a profiled
+    // pool that serves malloc itself cannot deadlock here
+    profile_sample *sample = malloc(sizeof(*sample));
+    if (!sample) {
+        return;
+    }
+    sample->ptr = ptr;
+    sample->size = size;
+    sample->depth = backtrace(sample->stack, PROFILE_DEPTH);
+    profile_insert(profiler, sample);
+}
+
+// Drops the sample of a freed block, if it has one
+void mem_profiler_free(mem_profiler_t *profiler, void *ptr) {
+    free(profile_take(profiler, ptr));
+}
+
+// Moves the sample of a resized block to its new address and size, so it stays
+// attributed to where the block was allocated. Unsampled blocks count as allocated anew.
+void mem_profiler_resize(mem_profiler_t *profiler, void *old_ptr, void *ptr, size_t size) {
+    profile_sample *sample = profile_take(profiler, old_ptr);
+    if (!sample) {
+        mem_profiler_alloc(profiler, ptr, size);
+        return;
+    }
+    sample->ptr = ptr;
+    sample->size = size;
+    profile_insert(profiler, sample);
+}
+
+// Writes the live samples in the legacy text heap profile format of gperftools, one
+// line per sample with its raw size, followed by the memory map pprof needs to
+// symbolize the addresses
+int mem_profiler_dump(mem_profiler_t *profiler, int fd) {
+    pthread_mutex_lock(&profiler->mutex);
+    size_t count = 0;
+    size_t bytes = 0;
+    for (int i = 0; i < PROFILE_BUCKETS; i++) {
+        for (profile_sample *sample = profiler->buckets[i]; sample != NULL; sample = sample->next) {
+            count++;
+            bytes += sample->size;
+        }
+    }
+    size_t mean = __atomic_load_n(&profiler->sample_bytes, __ATOMIC_RELAXED);
+    int result = dprintf(fd, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", count, bytes, count, bytes, mean) < 0 ? -1 : 0;
+    for (int i = 0; i < PROFILE_BUCKETS && result == 0; i++) {
+        for (profile_sample *sample = profiler->buckets[i]; sample != NULL && result == 0; sample = sample->next) {
+            result = dprintf(fd, "1: %zu [1: %zu] @", sample->size, sample->size) < 0 ? -1 : 0;
+            for (int frame = 0; frame < sample->depth && result == 0; frame++) {
+                result = dprintf(fd, " %p", sample->stack[frame]) < 0 ? -1 : 0;
+            }
+            if (result == 0 && dprintf(fd, "\n") < 0) {
+                result = -1;
+            }
+        }
+    }
+    pthread_mutex_unlock(&profiler->mutex);
+
+    if (result == 0 && dprintf(fd, "\nMAPPED_LIBRARIES:\n") < 0) {
+        result = -1;
+    }
+    int maps = open("/proc/self/maps", O_RDONLY);
+    if (maps >= 0) {
+        char buffer[4096];
+        ssize_t length;
+        while (result == 0 && (length = read(maps, buffer, sizeof(buffer))) > 0) {
+            if (write(fd, buffer, length) != length) {
+                result = -1;
+            }
+        }
+        close(maps);
+    }
+    return result;
+}
+
+void mem_profiler_destroy(mem_profiler_t *profiler) {
+    for (int i = 0; i < PROFILE_BUCKETS; i++) {
+        while (profiler->buckets[i]) {
+            profile_sample *sample = profiler->buckets[i];
+            profiler->buckets[i] = sample->next;
+            free(sample);
+        }
+    }
+    pthread_mutex_destroy(&profiler->mutex);
+    free(profiler);
+}
@@ -0,0 +1,384 @@
+#include "memory_manager.h"
+#include "memory_manager_internal.h"
+#include <malloc.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Replays a trace written by mem_trace_start against a fresh pool, or glibc malloc,
+// and reports the time taken, the peak footprint and the fragmentation.
+//
+// Each recorded thread is replayed on a thread of its own, unless --single replays
+// every record in trace order on one thread. Blocks are often freed by another thread
+// than the one that allocated them, so every record carries its position among the
+// records of its block, and a thread waits until the block's earlier records have
+// been replayed. The trace order satisfies all of these waits, so they cannot deadlock.
+//
+// A monitor thread samples the pool's statistics every --interval microseconds for
+// the peak footprint and the worst fragmentation.
+
+#define REPLAY_MAX_THREADS 256
+
+typedef struct {
+    const struct mem_trace_record *records;
+    size_t count;
+    uint32_t max_id;
+    void **blocks;     // Replayed block of each id
+    size_t *sizes;     // Requested bytes of each live id
+    uint32_t *seq;     // Position of each record among the records of its id
+    uint32_t *done;    // Records of each id replayed so far
+    mem_pool_t *pool;  // NULL to replay against malloc
+    size_t live_bytes; // Requested bytes live now and at the peak
+    size_t peak_live_bytes;
+    size_t failures;
+    bool finished;
+} replay_state;
+
+typedef struct {
+    replay_state *state;
+    size_t *indices; // Records of this thread, in trace order
+    size_t count;
+    pthread_t thread;
+} replay_worker;
+
+typedef struct {
+    size_t peak_used;
+    double max_fragmentation;
+} replay_footprint;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void add_live(replay_state *state, size_t added, size_t removed) {
+    size_t live = __atomic_add_fetch(&state->live_bytes, added - removed, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&state->peak_live_bytes, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&state->peak_live_bytes, &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void replay_record(replay_state *state, const struct mem_trace_record *record) {
+    void **block = &state->blocks[record->id];
+    size_t alignment = record->align_log2 ? (size_t)1 << record->align_log2 : 0;
+    void *result = NULL;
+    switch (record->op) {
+    case MEM_TRACE_ALLOC:
+        if (!state->pool) {
+            result = alignment ? aligned_alloc(alignment, (record->size + alignment - 1) & ~(alignment - 1)) : malloc(record->size);
+        } else {
+            result = alignment ? mem_pool_alloc_aligned(state->pool, record->size, alignment) : mem_pool_alloc(state->pool, record->size);
+        }
+        break;
+    case MEM_TRACE_FREE:
+        if (state->pool) {
+            mem_pool_free(state->pool, *block);
+        } else {
+            free(*block);
+        }
+        break;
+    case MEM_TRACE_RESIZE:
+        result = state->pool ? mem_pool_resize(state->pool, *block, record->size) : realloc(*block, record->size);
+        break;
+    }
+    size_t size = record->size;
+    if (record->op != MEM_TRACE_FREE && !result) {
+        __atomic_add_fetch(&state->failures, 1, __ATOMIC_RELAXED);
+        result = *block; // A failed resize leaves the block where it was
+        size = state->sizes[record->id];
+    }
+    *block = result;
+    size = result ? size : 0;
+    add_live(state, size, state->sizes[record->id]);
+    state->sizes[record->id] = size;
+}
+
+static void *replay_thread(void *arg) {
+    replay_worker *worker = arg;
+    replay_state *state = worker->state;
+    for (size_t i = 0; i < worker->count; i++) {
+        size_t index = worker->indices[i];
+        const struct mem_trace_record *record = &state->records[index];
+        while (__atomic_load_n(&state->done[record->id], __ATOMIC_ACQUIRE) != state->seq[index]) {
+            sched_yield(); // Another thread has yet to replay an earlier record of the block
+        }
+        replay_record(state, record);
+        __atomic_store_n(&state->done[record->id], state->seq[index] + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+typedef struct {
+    replay_state *state;
+    useconds_t interval;
+    replay_footprint footprint;
+} replay_monitor;
+
+static void sample_footprint(replay_monitor *monitor) {
+    if (monitor->state->pool) {
+        struct mem_stats stats;
+        mem_pool_stats(monitor->state->pool, &stats);
+        if (stats.used_bytes > monitor->footprint.peak_used) {
+            monitor->footprint.peak_used = stats.used_bytes;
+        }
+        if (stats.fragmentation > monitor->footprint.max_fragmentation) {
+            monitor->footprint.max_fragmentation = stats.fragmentation;
+        }
+    } else {
+        struct mallinfo2 info = mallinfo2();
+        if (info.uordblks > monitor->footprint.peak_used) {
+            monitor->footprint.peak_used = info.uordblks;
+        }
+    }
+}
+
+static void *monitor_thread(void *arg) {
+    replay_monitor *monitor = arg;
+    while (!__atomic_load_n(&monitor->state->finished, __ATOMIC_ACQUIRE)) {
+        sample_footprint(monitor);
+        usleep(monitor->interval);
+    }
+    return NULL;
+}
+
+// Reads the whole trace into memory, checking its header
+static struct mem_trace_record *read_trace(const char *path, size_t *count) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return NULL;
+    }
+    struct mem_trace_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, MEM_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != MEM_TRACE_VERSION || header.record_size != sizeof(struct mem_trace_record)) {
+        fprintf(stderr, "%s: not a version %d trace\n", path, MEM_TRACE_VERSION);
+        fclose(file);
+        return NULL;
+    }
+    size_t capacity = 1024;
+    struct mem_trace_record *records = malloc(capacity * sizeof(*records));
+    *count = 0;
+    size_t read;
+    while (records && (read = fread(records + *count, sizeof(*records), capacity - *count, file)) > 0) {
+        *count += read;
+        if (*count == capacity) {
+            capacity *= 2;
+            struct mem_trace_record *grown = realloc(records, capacity * sizeof(*records));
+            if (!grown) {
+                free(records);
+            }
+            records = grown;
+        }
+    }
+    fclose(file);
+    if (!records) {
+        fprintf(stderr, "%s: out of memory\n", path);
+    }
+    return records;
+}
+
+// Numbers the records of each id and finds the peak of requested live bytes, which
+// sizes the default pool. Returns false if the trace refers to blocks it never allocated.
+static bool index_trace(replay_state *state, size_t *peak_bytes) {
+    state->max_id = 0;
+    for (size_t i = 0; i < state->count; i++) {
+        if (state->records[i].id > state->max_id) {
+            state->max_id = state->records[i].id;
+        }
+    }
+    state->blocks = calloc(state->max_id + 1, sizeof(void *));
+    state->sizes = calloc(state->max_id + 1, sizeof(size_t));
+    state->done = calloc(state->max_id + 1, sizeof(uint32_t));
+    state->seq = malloc(state->count * sizeof(uint32_t));
+    if (!state->blocks || !state->sizes || !state->done || !state->seq) {
+        return false;
+    }
+    size_t live = 0;
+    *peak_bytes = 0;
+    for (size_t i = 0; i < state->count; i++) {
+        const struct mem_trace_record *record = &state->records[i];
+        if (record->id == 0 || (record->op == MEM_TRACE_ALLOC) != (state->done[record->id] == 0)) {
+            return false;
+        }
+        state->seq[i] = state->done[record->id]++;
+        live += (record->op == MEM_TRACE_FREE ? 0 : record->size) - state->sizes[record->id];
+        state->sizes[record->id] = (record->op == MEM_TRACE_FREE) ? 0 : record->size;
+        if (live > *peak_bytes) {
+            *peak_bytes = live;
+        }
+    }
+    memset(state->sizes, 0, (state->max_id + 1) * sizeof(size_t));
+    memset(state->done, 0, (state->max_id + 1) * sizeof(uint32_t));
+    return true;
+}
+
+// Splits the records among one worker per recorded thread, or a single worker
+static int assign_workers(replay_state *state, bool single, replay_worker *workers) {
+    int map[65536];
+    memset(map, -1, sizeof(map));
+    int count = 0;
+    for (size_t i = 0; i < state->count; i++) {
+        uint16_t thread = single ? 0 : state->records[i].thread;
+        if (map[thread] < 0) {
+            if (count == REPLAY_MAX_THREADS) {
+                return -1;
+            }
+            map[thread] = count;
+            workers[count++] = (replay_worker){state, NULL, 0, 0};
+        }
+        workers[map[thread]].count++;
+    }
+    for (int w = 0; w < count; w++) {
+        workers[w].indices = malloc(workers[w].count * sizeof(size_t));
+        if (!workers[w].indices) {
+            return -1;
+        }
+        workers[w].count = 0;
+    }
+    for (size_t i = 0; i < state->count; i++) {
+        replay_worker *worker = &workers[map[single ? 0 : state->records[i].thread]];
+        worker->indices[worker->count++] = i;
+    }
+    return count;
+}
+
+static void usage(const char *program) {
+    printf("Usage: %s [options] TRACE\n", program);
+    printf("  --allocator NAME  Replay against mem (default), mem_buddy, mem_sharded or malloc\n");
+    printf("  --single          Replay every record on one thread, in trace order\n");
+    printf("  --pool-size N     Pool bytes (default 4 times the peak of requested live bytes)\n");
+    printf("  --interval US     Microseconds between footprint samples (default 1000)\n");
+    printf("  --format text|csv|json  Output format (default text)\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *allocator = "mem";
+    const char *format = "text";
+    const char *path = NULL;
+    bool single = false;
+    size_t pool_size = 0;
+    useconds_t interval = 1000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--allocator") == 0 && i + 1 < argc) {
+            allocator = argv[++i];
+        } else if (strcmp(argv[i], "--single") == 0) {
+            single = true;
+        } else if (strcmp(argv[i], "--pool-size") == 0 && i + 1 < argc) {
+            pool_size = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+            interval = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            format = argv[++i];
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    replay_state state = {0};
+    struct mem_trace_record *records = read_trace(path, &state.count);
+    if (!records) {
+        return 1;
+    }
+    state.records = records;
+    size_t peak_bytes;
+    if (!index_trace(&state, &peak_bytes)) {
+        fprintf(stderr, "%s: inconsistent trace\n", path);
+        return 1;
+    }
+    if (strcmp(allocator, "malloc") != 0) {
+        struct mem_pool_options options = {.backing = MEM_BACKING_MMAP};
+        if (strcmp(allocator, "mem_buddy") == 0) {
+            options.backend = MEM_BACKEND_BUDDY;
+        } else if (strcmp(allocator, "mem_sharded") == 0) {
+            options.shards = 4;
+        } else if (strcmp(allocator, "mem") != 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (pool_size == 0) {
+            pool_size = (peak_bytes * 4 > 1024 * 1024) ? peak_bytes * 4 : 1024 * 1024;
+        }
+        if (!(state.pool = mem_pool_create_ex(pool_size, &options))) {
+            fprintf(stderr, "cannot create a pool of %zu bytes\n", pool_size);
+            return 1;
+        }
+    }
+    static replay_worker workers[REPLAY_MAX_THREADS];
+    int threads = assign_workers(&state, single, workers);
+    if (threads < 0) {
+        fprintf(stderr, "%s: more than %d threads\n", path, REPLAY_MAX_THREADS);
+        return 1;
+    }
+
+    replay_monitor monitor = {&state, interval, {0, 0.0}};
+    pthread_t monitor_id;
+    pthread_create(&monitor_id, NULL, monitor_thread, &monitor);
+    uint64_t start = now_ns();
+    for (int w = 0; w < threads; w++) {
+        pthread_create(&workers[w].thread, NULL, replay_thread, &workers[w]);
+    }
+    for (int w = 0; w < threads; w++) {
+        pthread_join(workers[w].thread, NULL);
+    }
+    double seconds = (now_ns() - start) / 1e9;
+    __atomic_store_n(&state.finished, true, __ATOMIC_RELEASE);
+    pthread_join(monitor_id, NULL);
+    sample_footprint(&monitor);
+
+    double recorded = state.count ? records[state.count - 1].time_ns / 1e9 : 0.0;
+    double ops_per_sec = seconds > 0 ? state.count / seconds : 0;
+    double overhead = state.peak_live_bytes ? (double)monitor.footprint.peak_used / state.peak_live_bytes : 0.0;
+    if (strcmp(format, "json") == 0) {
+        printf("{\"allocator\": \"%s\", \"records\": %zu, \"threads\": %d, \"recorded_seconds\": %.6f, \"seconds\": %.6f, "
+               "\"ops_per_sec\": %.0f, \"peak_requested_bytes\": %zu, \"peak_used_bytes\": %zu, \"overhead\": %.3f, "
+               "\"max_fragmentation\": %.3f, \"failures\": %zu}\n",
+               allocator, state.count, threads, recorded, seconds, ops_per_sec, state.peak_live_bytes,
+               monitor.footprint.peak_used, overhead, monitor.footprint.max_fragmentation, state.failures);
+    } else if (strcmp(format, "csv") == 0) {
+        printf("allocator,records,threads,recorded_seconds,seconds,ops_per_sec,peak_requested_bytes,peak_used_bytes,overhead,max_fragmentation,failures\n");
+        printf("%s,%zu,%d,%.6f,%.6f,%.0f,%zu,%zu,%.3f,%.3f,%zu\n", allocator, state.count, threads, recorded, seconds,
+               ops_per_sec, state.peak_live_bytes, monitor.footprint.peak_used, overhead, monitor.footprint.max_fragmentation,
+               state.failures);
+    } else {
+        printf("Allocator:            %s\n", allocator);
+        printf("Records:              %zu on %d thread%s\n", state.count, threads, threads == 1 ? "" : "s");
+        printf("Recorded time:        %.6f s\n", recorded);
+        printf("Replay time:          %.6f s (%.0f ops/s)\n", seconds, ops_per_sec);
+        printf("Peak requested bytes: %zu\n", state.peak_live_bytes);
+        printf("Peak used bytes:      %zu (%.3fx)\n", monitor.footprint.peak_used, overhead);
+        printf("Max fragmentation:    %.3f\n", monitor.footprint.max_fragmentation);
+        printf("Failed allocations:   %zu\n", state.failures);
+    }
+
+    for (size_t id = 1; id <= state.max_id; id++) {
+        if (state.blocks[id] && state.pool) {
+            mem_pool_free(state.pool, state.blocks[id]);
+        } else if (state.blocks[id]) {
+            free(state.blocks[id]);
+        }
+    }
+    for (int w = 0; w < threads; w++) {
+        free(workers[w].indices);
+    }
+    if (state.pool) {
+        mem_pool_destroy(state.pool);
+    }
+    free(state.blocks);
+    free(state.sizes);
+    free(state.seq);
+    free(state.done);
+    free(records);
+    return 0;
+}
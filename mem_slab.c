@@ -0,0 +1,193 @@
+#include "memory_manager.h"
+#include "memory_manager_internal.h"
+#include <stdint.h>
+
+// A slab is one pool block of slab_size bytes holding a header followed by up to
+// SLAB_MAX_OBJECTS objects, with a bitmap in the header tracking which are in use.
+// Slabs are aligned to their own power-of-two size, so the slab owning an object is
+// found by masking the object's address and objects need no header of their own.
+#define SLAB_MAX_OBJECTS 256
+#define SLAB_TARGET_OBJECTS 64
+#define SLAB_MIN_SIZE 256
+
+typedef struct slab {
+    mem_slab_t *cache;
+    struct slab *next; // Neighbours on the cache's partial or full list
+    struct slab *prev;
+    uint32_t used;
+    uint64_t bitmap[SLAB_MAX_OBJECTS / 64]; // Set bits are objects in use or past capacity
+} slab;
+
+struct mem_slab {
+    mem_pool_t *pool;
+    size_t stride;       // Object size rounded up to the alignment
+    size_t slab_size;    // Bytes per slab, also its alignment
+    size_t first_offset; // Offset of the first object from the start of a slab
+    uint32_t capacity;   // Objects per slab
+    slab *partial;       // Slabs with at least one free object
+    slab *full;
+    slab *empty;         // One fully free slab kept back from the pool
+    pthread_mutex_t mutex;
+};
+
+static size_t round_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+static void slab_list_push(slab **list, slab *s) {
+    s->prev = NULL;
+    s->next = *list;
+    if (*list) {
+        (*list)->prev = s;
+    }
+    *list = s;
+}
+
+static void slab_list_remove(slab **list, slab *s) {
+    if (s->prev) {
+        s->prev->next = s->next;
+    } else {
+        *list = s->next;
+    }
+    if (s->next) {
+        s->next->prev = s->prev;
+    }
+}
+
+// Takes a fresh slab from the pool and marks the bitmap bits past capacity as used
+static slab *slab_new(mem_slab_t *cache) {
+    slab *s = mem_pool_alloc_aligned(cache->pool, cache->slab_size, cache->slab_size);
+    if (!s) {
+        return NULL;
+    }
+    s->cache = cache;
+    s->used = 0;
+    memset(s->bitmap, 0, sizeof(s->bitmap));
+    for (uint32_t i = cache->capacity; i < SLAB_MAX_OBJECTS; i++) {
+        s->bitmap[i / 64] |= 1ULL << (i % 64);
+    }
+    return s;
+}
+
+// Creation function: creates a cache of objects of obj_size bytes, each aligned to
+// align (a power of two, 0 for the pool granule), carved from the given pool
+mem_slab_t *mem_pool_slab_create(mem_pool_t *pool, size_t obj_size, size_t align) {
+    if (!pool || (align & (align - 1)) != 0) {
+        return NULL;
+    }
+    if (align == 0) {
+        align = 16;
+    }
+    mem_slab_t *cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+    cache->pool = pool;
+    cache->stride = round_up(obj_size ? obj_size : 1, align);
+    cache->first_offset = round_up(sizeof(slab), align);
+    cache->slab_size = SLAB_MIN_SIZE;
+    while (cache->slab_size < cache->first_offset + SLAB_TARGET_OBJECTS * cache->stride) {
+        cache->slab_size <<= 1;
+    }
+    size_t capacity = (cache->slab_size - cache->first_offset) / cache->stride;
+    cache->capacity = (capacity < SLAB_MAX_OBJECTS) ? capacity : SLAB_MAX_OBJECTS;
+    pthread_mutex_init(&cache->mutex, NULL);
+    return cache;
+}
+
+mem_slab_t *mem_slab_create(size_t obj_size, size_t align) {
+    mem_pool_t *pool = mem_default_pool();
+    return pool ? mem_pool_slab_create(pool, obj_size, align) : NULL;
+}
+
+// Allocation function: hands out the first free object of a partially used slab
+void* mem_slab_alloc(mem_slab_t *cache) {
+    pthread_mutex_lock(&cache->mutex);
+    slab *s = cache->partial;
+    if (!s) {
+        s = cache->empty ? cache->empty : slab_new(cache);
+        if (!s) {
+            pthread_mutex_unlock(&cache->mutex);
+            return NULL;
+        }
+        cache->empty = NULL;
+        slab_list_push(&cache->partial, s);
+    }
+
+    uint32_t word = 0;
+    while (s->bitmap[word] == ~0ULL) {
+        word++;
+    }
+    uint32_t index = word * 64 + __builtin_ctzll(~s->bitmap[word]);
+    s->bitmap[word] |= 1ULL << (index % 64);
+    if (++s->used == cache->capacity) {
+        slab_list_remove(&cache->partial, s);
+        slab_list_push(&cache->full, s);
+    }
+    pthread_mutex_unlock(&cache->mutex);
+    return (char *)s + cache->first_offset + index * cache->stride;
+}
+
+// Deallocation function: returns an object of this cache to its slab, ignoring objects
+// that are already free or not from this cache. A slab that becomes empty is kept or
+// given back to the pool.
+void mem_slab_free(mem_slab_t *cache, void *obj) {
+    if (!obj) {
+        return;
+    }
+    slab *s = (slab *)((uintptr_t)obj & ~(uintptr_t)(cache->slab_size - 1));
+    size_t offset = (char *)obj - (char *)s;
+    if (offset < cache->first_offset || (offset - cache->first_offset) % cache->stride != 0) {
+        return;
+    }
+    uint32_t index = (offset - cache->first_offset) / cache->stride;
+
+    // The masked address is only a slab header if the pool has a live block there;
+    // slabs of this cache are given back under the mutex, so one cannot go meanwhile
+    pthread_mutex_lock(&cache->mutex);
+    if (!mem_pool_owns(cache->pool, s) || s->cache != cache) {
+        pthread_mutex_unlock(&cache->mutex);
+        return;
+    }
+    uint64_t mask = 1ULL << (index % 64);
+    if (index >= cache->capacity || !(s->bitmap[index / 64] & mask)) {
+        pthread_mutex_unlock(&cache->mutex);
+        return; // Already free
+    }
+    s->bitmap[index / 64] &= ~mask;
+    if (s->used-- == cache->capacity) {
+        slab_list_remove(&cache->full, s);
+        slab_list_push(&cache->partial, s);
+    }
+    if (s->used == 0) {
+        slab_list_remove(&cache->partial, s);
+        if (cache->empty) {
+            s->cache = NULL;
+            mem_pool_free(cache->pool, s);
+        } else {
+            cache->empty = s;
+        }
+    }
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+static void slab_list_release(mem_slab_t *cache, slab *s) {
+    while (s) {
+        slab *next = s->next;
+        s->cache = NULL;
+        mem_pool_free(cache->pool, s);
+        s = next;
+    }
+}
+
+// Destruction function: gives every slab back to the pool and frees the cache
+void mem_slab_destroy(mem_slab_t *cache) {
+    slab_list_release(cache, cache->partial);
+    slab_list_release(cache, cache->full);
+    if (cache->empty) {
+        cache->empty->next = NULL;
+        slab_list_release(cache, cache->empty);
+    }
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache);
+}
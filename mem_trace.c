@@ -0,0 +1,269 @@
+#include "memory_manager.h"
+#include "memory_manager_internal.h"
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+// The tracer writes one record per allocation, free and resize. Raw addresses mean
+// nothing to a replay, so each block gets an id when it is allocated and keeps it
+// through resizes; a table from live addresses to ids, open addressed with linear
+// probing, finds it again. Blocks allocated before the trace started have no id and
+// their frees and resizes are left out. Records are appended to a buffer under the
+// tracer's mutex, which also orders them, and written out when it fills.
+#define TRACE_BUFFER_RECORDS 4096
+#define TRACE_MIN_SLOTS 1024
+
+typedef struct {
+    void *ptr; // NULL for an empty slot
+    uint32_t id;
+} trace_slot;
+
+struct mem_tracer {
+    int fd;         // -1 while stopped, read without the mutex to skip stopped hooks
+    bool failed;    // A write has failed since the trace started
+    uint64_t start_ns;
+    uint32_t next_id;
+    pthread_mutex_t mutex;
+    trace_slot *slots;
+    size_t capacity; // A power of two
+    size_t live;
+    size_t buffered;
+    struct mem_trace_record buffer[TRACE_BUFFER_RECORDS];
+};
+
+static uint32_t trace_threads;
+static __thread uint16_t trace_thread; // 0 until the thread records its first call
+
+static uint64_t trace_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t slot_of(mem_tracer_t *tracer, void *ptr) {
+    uintptr_t key = (uintptr_t)ptr >> 4;
+    return (key * 0x9e3779b97f4a7c15ULL) & (tracer->capacity - 1);
+}
+
+static bool write_all(int fd, const void *data, size_t length) {
+    const char *bytes = data;
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written <= 0) {
+            return false;
+        }
+        bytes += written;
+        length -= written;
+    }
+    return true;
+}
+
+static void trace_flush(mem_tracer_t *tracer) {
+    if (tracer->buffered && !write_all(tracer->fd, tracer->buffer, tracer->buffered * sizeof(tracer->buffer[0]))) {
+        tracer->failed = true;
+    }
+    tracer->buffered = 0;
+}
+
+static void trace_emit(mem_tracer_t *tracer, uint8_t op, uint32_t id, size_t size, size_t alignment) {
+    if (trace_thread == 0) {
+        trace_thread = __atomic_add_fetch(&trace_threads, 1, __ATOMIC_RELAXED);
+    }
+    struct mem_trace_record *record = &tracer->buffer[tracer->buffered];
+    record->time_ns = trace_now_ns() - tracer->start_ns;
+    record->size = size;
+    record->id = id;
+    record->thread = trace_thread;
+    record->op = op;
+    record->align_log2 = alignment ? __builtin_ctzll(alignment) : 0;
+    if (++tracer->buffered == TRACE_BUFFER_RECORDS) {
+        trace_flush(tracer);
+    }
+}
+
+static void slot_insert(trace_slot *slots, size_t capacity, size_t slot, void *ptr, uint32_t id) {
+    while (slots[slot].ptr) {
+        slot = (slot + 1) & (capacity - 1);
+    }
+    slots[slot] = (trace_slot){ptr, id};
+}
+
+// Doubles the table once it is half full. On failure the table keeps its size and
+// the id is not recorded, so only that block goes untraced.
+static bool table_reserve(mem_tracer_t *tracer) {
+    if (tracer->live < tracer->capacity / 2) {
+        return true;
+    }
+    size_t capacity = tracer->capacity ? tracer->capacity * 2 : TRACE_MIN_SLOTS;
+    trace_slot *slots = calloc(capacity, sizeof(*slots));
+    if (!slots) {
+        return false;
+    }
+    trace_slot *old = tracer->slots;
+    size_t old_capacity = tracer->capacity;
+    tracer->slots = slots;
+    tracer->capacity = capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].ptr) {
+            slot_insert(slots, capacity, slot_of(tracer, old[i].ptr), old[i].ptr, old[i].id);
+        }
+    }
+    free(old);
+    return true;
+}
+
+static bool table_insert(mem_tracer_t *tracer, void *ptr, uint32_t id) {
+    if (!table_reserve(tracer)) {
+        return false;
+    }
+    slot_insert(tracer->slots, tracer->capacity, slot_of(tracer, ptr), ptr, id);
+    tracer->live++;
+    return true;
+}
+
+// Removes ptr from the table and returns its id, or 0 if it has none. The entries
+// after it in the same run move back, so lookups never need tombstones.
+static uint32_t table_take(mem_tracer_t *tracer, void *ptr) {
+    if (!ptr || tracer->live == 0) {
+        return 0;
+    }
+    size_t mask = tracer->capacity - 1;
+    size_t slot = slot_of(tracer, ptr);
+    while (tracer->slots[slot].ptr != ptr) {
+        if (!tracer->slots[slot].ptr) {
+            return 0;
+        }
+        slot = (slot + 1) & mask;
+    }
+    uint32_t id = tracer->slots[slot].id;
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; tracer->slots[next].ptr; next = (next + 1) & mask) {
+        size_t home = slot_of(tracer, tracer->slots[next].ptr);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            tracer->slots[hole] = tracer->slots[next];
+            hole = next;
+        }
+    }
+    tracer->slots[hole].ptr = NULL;
+    tracer->live--;
+    return id;
+}
+
+static bool tracer_active(mem_tracer_t *tracer) {
+    return __atomic_load_n(&tracer->fd, __ATOMIC_RELAXED) >= 0;
+}
+
+mem_tracer_t *mem_tracer_create() {
+    mem_tracer_t *tracer = calloc(1, sizeof(*tracer));
+    if (tracer) {
+        tracer->fd = -1;
+        pthread_mutex_init(&tracer->mutex, NULL);
+    }
+    return tracer;
+}
+
+// Writes the header and starts recording into fd. Returns -1 if a trace is already
+// being recorded or the header cannot be written.
+int mem_tracer_start(mem_tracer_t *tracer, int fd) {
+    struct mem_trace_header header = {MEM_TRACE_MAGIC, MEM_TRACE_VERSION, sizeof(struct mem_trace_record)};
+    pthread_mutex_lock(&tracer->mutex);
+    if (tracer->fd >= 0 || fd < 0 || !write_all(fd, &header, sizeof(header))) {
+        pthread_mutex_unlock(&tracer->mutex);
+        return -1;
+    }
+    if (tracer->live) {
+        memset(tracer->slots, 0, tracer->capacity * sizeof(*tracer->slots));
+        tracer->live = 0;
+    }
+    tracer->failed = false;
+    tracer->next_id = 1;
+    tracer->start_ns = trace_now_ns();
+    __atomic_store_n(&tracer->fd, fd, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&tracer->mutex);
+    return 0;
+}
+
+// Writes out the buffered records and stops recording, leaving fd open. Returns -1
+// if no trace was being recorded or any write failed.
+int mem_tracer_stop(mem_tracer_t *tracer) {
+    pthread_mutex_lock(&tracer->mutex);
+    int result = -1;
+    if (tracer->fd >= 0) {
+        trace_flush(tracer);
+        result = tracer->failed ? -1 : 0;
+        __atomic_store_n(&tracer->fd, -1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&tracer->mutex);
+    return result;
+}
+
+// Records an allocation, giving the block a fresh id
+void mem_tracer_alloc(mem_tracer_t *tracer, void *ptr, size_t size, size_t alignment) {
+    if (!ptr || !tracer_active(tracer)) {
+        return;
+    }
+    pthread_mutex_lock(&tracer->mutex);
+    if (tracer->fd >= 0 && table_insert(tracer, ptr, tracer->next_id)) {
+        trace_emit(tracer, MEM_TRACE_ALLOC, tracer->next_id++, size, alignment);
+    }
+    pthread_mutex_unlock(&tracer->mutex);
+}
+
+// Records a free. Called before the block is given back, so no other thread can have
+// been handed the same address yet.
+void mem_tracer_free(mem_tracer_t *tracer, void *ptr) {
+    if (!ptr || !tracer_active(tracer)) {
+        return;
+    }
+    pthread_mutex_lock(&tracer->mutex);
+    uint32_t id = tracer->fd >= 0 ? table_take(tracer, ptr) : 0;
+    if (id) {
+        trace_emit(tracer, MEM_TRACE_FREE, id, 0, 0);
+    }
+    pthread_mutex_unlock(&tracer->mutex);
+}
+
+// A resize is recorded in two steps around the pool's resize: the first takes the
+// block's id out of the table before its old address can be reused, the second files
+// the id under the new address and writes the record.
+uint32_t mem_tracer_resize_begin(mem_tracer_t *tracer, void *old_ptr) {
+    if (!old_ptr || !tracer_active(tracer)) {
+        return 0;
+    }
+    pthread_mutex_lock(&tracer->mutex);
+    uint32_t id = tracer->fd >= 0 ? table_take(tracer, old_ptr) : 0;
+    pthread_mutex_unlock(&tracer->mutex);
+    return id;
+}
+
+void mem_tracer_resize_end(mem_tracer_t *tracer, uint32_t id, void *old_ptr, void *ptr, size_t size) {
+    if (!id && !tracer_active(tracer)) {
+        return;
+    }
+    pthread_mutex_lock(&tracer->mutex);
+    if (tracer->fd < 0) {
+        // Stopped in between, nothing to record
+    } else if (ptr && id) {
+        if (table_insert(tracer, ptr, id)) {
+            trace_emit(tracer, MEM_TRACE_RESIZE, id, size, 0);
+        } else {
+            trace_emit(tracer, MEM_TRACE_FREE, id, 0, 0); // Untraced from here on
+        }
+    } else if (ptr) {
+        if (table_insert(tracer, ptr, tracer->next_id)) {
+            trace_emit(tracer, MEM_TRACE_ALLOC, tracer->next_id++, size, 0); // Untraced or new block
+        }
+    } else if (id && size == 0) {
+        trace_emit(tracer, MEM_TRACE_FREE, id, 0, 0);
+    } else if (id) {
+        table_insert(tracer, old_ptr, id); // The resize failed and the block stays put
+    }
+    pthread_mutex_unlock(&tracer->mutex);
+}
+
+void mem_tracer_destroy(mem_tracer_t *tracer) {
+    mem_tracer_stop(tracer);
+    pthread_mutex_destroy(&tracer->mutex);
+    free(tracer->slots);
+    free(tracer);
+}
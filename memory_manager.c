@@ -1,195 +1,2967 @@
 #include "memory_manager.h"
+#include "memory_manager_internal.h"
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-typedef struct memory_block {
-    void *start;
-    void *end;
-    struct memory_block *next;
-} memory_block;
+// Requests are rounded up to whole granules; sizes up to MEM_EXACT_CLASSES
+// granules get one free list each, larger ones share a list per power of two.
+#define MEM_GRANULE 16
+#define MEM_EXACT_CLASSES 32
+#define MEM_NUM_CLASSES 64
+#define MEM_NIL UINT32_MAX
 
-memory_block *memory_block_init(void *start, void *end, memory_block *next) {
-    memory_block *new_block = malloc(sizeof(*new_block));
-    new_block->start = start;
-    new_block->end = end;
-    new_block->next = next;
-    return new_block;
+// Bitmap pools bound the free runs starting in each group of this many map words
+#define RUN_GROUP_WORDS 8
+
+// Block metadata lives in a side table with one boundary tag per granule, stored
+// after the pool in the same allocation. The first and last granule of every block
+// hold (size in granules << TAG_SHIFT) | flags; tags of interior granules are stale.
+// Backward coalescing only needs the used bit from the last tag of a used block, so
+// blocks flagged TAG_EXT keep their alignment (log2) there instead of the size.
+#define TAG_USED 1u
+#define TAG_EXT 2u
+#define TAG_SHIFT 2
+
+// Largest pool, or chunk or shard of one, whose block sizes fit a tag: 16 GiB less a
+// granule. Creating a larger one fails rather than truncating sizes.
+#define MEM_MAX_GRANULES (UINT32_MAX >> TAG_SHIFT)
+
+// Size of an explicit or transparent huge page on the platforms we run on
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// A file-backed pool maps the file as header, pool, start bitmap and tags. Block
+// metadata only holds granule indices, so the file can be mapped at any address; the
+// free lists live in memory and are rebuilt from the tags on every open. A file left
+// open by a crashed process has its tags checked first and is refused if torn.
+#define FILE_MAGIC "MEMPOOL1"
+#define FILE_HEADER_SIZE 4096
+
+struct file_header {
+    char magic[8];
+    uint64_t size;
+    uint64_t min_alignment;
+    uint64_t root;  // Offset of the root structure plus one, 0 for none
+    uint32_t clean; // Set by a clean close, clear while the file is open
+};
+
+// Thread caches hold up to cache_capacity freed blocks per exact size class and
+// exchange them with the pool in batches of CACHE_BATCH under the pool mutex
+#define CACHE_MAX_CAPACITY 1024
+#define CACHE_BATCH 16
+
+// Batch frees sort a copy of the caller's pointers, this many at a time, on the stack
+#define FREE_BATCH_CHUNK 256
+
+// Free blocks keep their free-list links in their own first granule
+typedef struct free_block {
+    uint32_t next;
+    uint32_t prev;
+} free_block;
+
+// Under best-fit the first granule holds an AVL tree node instead, keyed by
+// (size, index) so lookups find the smallest fitting block at the lowest address
+typedef struct tree_node {
+    uint32_t left;
+    uint32_t right;
+    uint32_t height;
+} tree_node;
+
+typedef struct thread_cache thread_cache;
+
+// Slot of the handle table. A live slot holds the index of its block, whose header
+// granule stores the handle back, so the compactor can map a block to its slot.
+// Free slots are chained through index and marked by HANDLE_FREE pins.
+typedef struct handle_slot {
+    uint32_t index;
+    uint32_t pins;
+} handle_slot;
+
+#define HANDLE_FREE UINT32_MAX
+
+// Counters behind mem_pool_stats, guarded by memory_lock. Allocations and frees
+// served by a thread cache are counted in its mem_cache_stats instead.
+struct pool_counters {
+    size_t allocs;
+    size_t frees;
+    size_t resizes;
+    size_t failed_allocs;
+    size_t searches;       // Free-list searches
+    size_t search_steps;   // Free blocks examined by those searches
+    size_t free_granules;  // Totals over the free lists, kept by free_list_push/remove
+    size_t free_blocks;
+};
+
+struct mem_pool {
+    void *memory_pool;
+    size_t size_of_pool;
+    size_t min_alignment; // Every block size and start is a multiple of this
+
+    // Backing actually obtained; mmap-backed pools are unmapped as a whole
+    enum mem_backing backing;
+    enum mem_huge_pages huge_pages;
+    size_t mapping_size;
+    struct file_header *file_header; // Start of the mapping for file-backed pools
+
+    uint32_t *block_tags;
+    // One bit per granule marking where used blocks start, so a pointer is mapped to
+    // its block in O(1) and foreign or already freed pointers are rejected
+    uint64_t *block_starts;
+    uint64_t *free_map; // Bitmap pools only: one bit per granule, set while it is free
+    // Bitmap pools only: per size class, a word of the free map before which no free
+    // run as long as the class's smallest size starts, where searches begin
+    uint32_t run_hints[MEM_NUM_CLASSES];
+    uint32_t longest_run; // Bitmap pools only: longest free run, MEM_NIL until recounted
+    // Bitmap pools only: per RUN_GROUP_WORDS words of the free map, no free run starting
+    // there is longer. Raised as runs are freed and lowered by searches that find none.
+    uint32_t *run_bounds;
+    uint32_t pool_granules;
+
+    // Segregated free lists of granule indices; bit i of free_classes is set while free_lists[i] is non-empty.
+    // Buddy pools keep one list per order instead, free_lists[k] holding blocks of 2^k granules.
+    uint32_t free_lists[MEM_NUM_CLASSES];
+    uint64_t free_classes;
+    enum mem_backend backend;
+    enum mem_placement placement;
+    uint32_t free_tree; // Root of the best-fit tree, which replaces the lists
+    uint32_t rover;     // Block where the next next-fit search starts
+
+    struct mem_lock memory_lock;
+    struct pool_counters counters;
+
+    pthread_key_t cache_key; // Created when caching is first turned on, keys being scarce
+    bool has_cache_key;
+    size_t cache_capacity;
+    thread_cache *caches;
+    struct mem_cache_stats retired_cache_stats; // Totals of caches whose thread has exited
+
+    struct mem_resize_stats resize_stats; // Guarded by memory_lock
+
+    mem_region_t *region; // Set for lock-free pools, where it covers the whole pool
+
+    // Handle table, guarded by memory_lock; handle h lives in slot h - 1
+    handle_slot *handles;
+    uint32_t handle_count;
+    uint32_t handle_capacity;
+    uint32_t free_handles;   // First free slot, MEM_NIL for none
+    uint32_t compact_cursor; // Where the next compaction step resumes
+    bool compact_moved;      // Whether the current compaction pass has moved a block
+
+    // A growable pool is the head of a chain of chunks, each a pool of its own. The
+    // chain is read-locked by every operation and write-locked to add or drop a chunk.
+    bool growable;
+    double growth_factor;
+    size_t max_size;         // Cap on the bytes of all chunks together, 0 for none
+    size_t chain_size;       // Bytes of all chunks together, guarded by chain_lock
+    struct mem_pool_options chunk_options;
+    mem_pool_t *next_chunk;
+    pthread_rwlock_t chain_lock;
+
+    // A sharded pool splits its memory into address ranges of shard_bytes, each managed
+    // by a pool of its own with its own mutex. The head manages the first range and
+    // links the others through next_chunk; shards[i] is the pool of range i.
+    mem_pool_t **shards;
+    uint32_t shard_count;
+    size_t shard_bytes;
+    bool borrowed; // A shard whose memory and metadata belong to the head
+
+    mem_profiler_t *profiler; // Created on the first mem_pool_profile_set_rate, NULL until then
+    mem_tracer_t *tracer;     // Created on the first mem_pool_trace_start, NULL until then
+};
+
+// Blocks in a thread cache stay marked used in the boundary tags, so they are never
+// coalesced, but their start bit is cleared so the pool treats them as freed
+struct thread_cache {
+    mem_pool_t *pool;
+    void *bins[MEM_EXACT_CLASSES]; // Singly linked through the first word of each block
+    uint32_t counts[MEM_EXACT_CLASSES];
+    struct mem_cache_stats stats;
+    struct thread_cache *next; // All live caches of the pool, guarded by memory_lock
+    struct thread_cache *prev;
+};
+
+// A region is a range of granules handed out by an atomic bump pointer without taking
+// memory_lock. Allocations are rounded to their size class (exact up to
+// MEM_EXACT_CLASSES granules, a power of two above), so a freed block fits any later
+// request of its class and is recycled through that class's lock-free stack. Each
+// allocation keeps its size in the tag of its first granule and its start bit. A
+// carved region starts one header after its pool block, whose first tag stays intact
+// so the blocks of the pool can still be walked in address order.
+struct mem_region {
+    mem_pool_t *pool;
+    uint32_t base;
+    uint32_t end;
+    uint64_t top; // Next granule to bump, may run past end once the region is full
+    // Start bits of the region's blocks from base: the pool's own bitmap for the region
+    // of a lock-free pool, otherwise the region's, so the pool never takes its blocks
+    uint64_t *starts;
+    struct pool_counters counters; // Only the operation counts, updated atomically
+    // Treiber stacks linked through the first word of each block; the head holds a
+    // version counter in its upper half so a recycled block cannot cause ABA
+    uint64_t free_stacks[MEM_NUM_CLASSES];
+};
+
+#define REGION_STACK_EMPTY ((uint64_t)MEM_NIL)
+
+// Counters are only written by the owning thread but may be read by mem_pool_cache_stats
+#define CACHE_COUNT(cache, field) \
+    __atomic_store_n(&(cache)->stats.field, (cache)->stats.field + 1, __ATOMIC_RELAXED)
+
+// Pool behind the mem_* functions, created by mem_init
+mem_pool_t *default_pool;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void pool_lock(mem_pool_t *pool) {
+    mem_lock_acquire(&pool->memory_lock);
+}
+
+static void pool_unlock(mem_pool_t *pool) {
+    mem_lock_release(&pool->memory_lock);
+}
+
+// Counts an allocation attempt, caller holds memory_lock
+static void count_alloc(mem_pool_t *pool, void *ptr) {
+    if (ptr) {
+        pool->counters.allocs++;
+    } else {
+        pool->counters.failed_allocs++;
+    }
+}
+
+#define REGION_COUNT(region, field) __atomic_fetch_add(&(region)->counters.field, 1, __ATOMIC_RELAXED)
+
+static size_t round_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+// Granules taken by a request of the given size, rounded to the pool's minimum alignment
+static uint32_t size_to_granules(mem_pool_t *pool, size_t size) {
+    return round_up(size, pool->min_alignment) / MEM_GRANULE;
+}
+
+// Maps a block size in granules to its free-list index
+static int size_class(uint32_t granules) {
+    if (granules <= MEM_EXACT_CLASSES) {
+        return granules - 1;
+    }
+    int log2 = 31 - __builtin_clz(granules);
+    return MEM_EXACT_CLASSES + log2 - 5;
+}
+
+static inline void *granule_ptr(mem_pool_t *pool, uint32_t index) {
+    return (char *)pool->memory_pool + (size_t)index * MEM_GRANULE;
+}
+
+static inline free_block *free_node(mem_pool_t *pool, uint32_t index) {
+    return (free_block *)granule_ptr(pool, index);
+}
+
+static inline tree_node *tree_at(mem_pool_t *pool, uint32_t index) {
+    return (tree_node *)granule_ptr(pool, index);
+}
+
+static inline uint32_t tag_size(mem_pool_t *pool, uint32_t index) {
+    return pool->block_tags[index] >> TAG_SHIFT;
+}
+
+static inline bool tag_used(mem_pool_t *pool, uint32_t index) {
+    return pool->block_tags[index] & TAG_USED;
+}
+
+// Start bits are also flipped by thread caches without the pool mutex, so every
+// access to the bitmap is atomic
+static inline bool block_is_start(mem_pool_t *pool, uint32_t index) {
+    return __atomic_load_n(&pool->block_starts[index / 64], __ATOMIC_ACQUIRE) & (1ULL << (index % 64));
+}
+
+static inline void block_mark_start(mem_pool_t *pool, uint32_t index) {
+    __atomic_fetch_or(&pool->block_starts[index / 64], 1ULL << (index % 64), __ATOMIC_RELEASE);
+}
+
+static inline void block_clear_start(mem_pool_t *pool, uint32_t index) {
+    __atomic_fetch_and(&pool->block_starts[index / 64], ~(1ULL << (index % 64)), __ATOMIC_RELEASE);
+}
+
+// Clears the start bit and reports whether it was set, so of two racing frees of
+// the same pointer exactly one wins
+static inline bool block_claim_start(mem_pool_t *pool, uint32_t index) {
+    uint64_t mask = 1ULL << (index % 64);
+    return __atomic_fetch_and(&pool->block_starts[index / 64], ~mask, __ATOMIC_ACQ_REL) & mask;
+}
+
+static void block_set(mem_pool_t *pool, uint32_t index, uint32_t granules, bool used) {
+    uint32_t tag = (granules << TAG_SHIFT) | (used ? TAG_USED : 0);
+    pool->block_tags[index] = tag;
+    pool->block_tags[index + granules - 1] = tag;
+    if (pool->rover > index && pool->rover < index + granules) {
+        pool->rover = index; // Keep the next-fit rover on a block start
+    }
+    if (pool->compact_cursor > index && pool->compact_cursor < index + granules) {
+        pool->compact_cursor = index; // And the compactor's cursor
+    }
+    if (used) {
+        block_mark_start(pool, index);
+    } else {
+        block_clear_start(pool, index);
+    }
+}
+
+// Updates the free map of a bitmap pool where granules [index, index + granules)
+// change between used and free. Blocks that only split or merge keep their bits.
+static void free_map_mark(mem_pool_t *pool, uint32_t index, uint32_t granules, bool free) {
+    if (pool->free_map) {
+        mem_bitmap_fill(pool->free_map, index, granules, free);
+    }
+}
+
+// Records that a used block of at least two granules must keep the given alignment,
+// which is larger than the pool's minimum, across moves
+static void block_set_alignment(mem_pool_t *pool, uint32_t index, size_t alignment) {
+    uint32_t granules = tag_size(pool, index);
+    pool->block_tags[index] |= TAG_EXT;
+    pool->block_tags[index + granules - 1] = (__builtin_ctzll(alignment) << TAG_SHIFT) | TAG_USED;
+}
+
+static size_t block_alignment(mem_pool_t *pool, uint32_t index) {
+    if (!(pool->block_tags[index] & TAG_EXT)) {
+        return pool->min_alignment;
+    }
+    return 1ULL << (pool->block_tags[index + tag_size(pool, index) - 1] >> TAG_SHIFT);
+}
+
+static uint32_t tree_height(mem_pool_t *pool, uint32_t node) {
+    return (node == MEM_NIL) ? 0 : tree_at(pool, node)->height;
+}
+
+static bool tree_less(mem_pool_t *pool, uint32_t a, uint32_t b) {
+    uint32_t size_a = tag_size(pool, a);
+    uint32_t size_b = tag_size(pool, b);
+    return size_a < size_b || (size_a == size_b && a < b);
+}
+
+static void tree_update(mem_pool_t *pool, uint32_t node) {
+    uint32_t left = tree_height(pool, tree_at(pool, node)->left);
+    uint32_t right = tree_height(pool, tree_at(pool, node)->right);
+    tree_at(pool, node)->height = ((left > right) ? left : right) + 1;
+}
+
+static uint32_t tree_rotate_right(mem_pool_t *pool, uint32_t node) {
+    uint32_t top = tree_at(pool, node)->left;
+    tree_at(pool, node)->left = tree_at(pool, top)->right;
+    tree_at(pool, top)->right = node;
+    tree_update(pool, node);
+    tree_update(pool, top);
+    return top;
+}
+
+static uint32_t tree_rotate_left(mem_pool_t *pool, uint32_t node) {
+    uint32_t top = tree_at(pool, node)->right;
+    tree_at(pool, node)->right = tree_at(pool, top)->left;
+    tree_at(pool, top)->left = node;
+    tree_update(pool, node);
+    tree_update(pool, top);
+    return top;
+}
+
+// Restores the AVL balance of a subtree whose children differ in height by at most two
+static uint32_t tree_balance(mem_pool_t *pool, uint32_t node) {
+    tree_node *n = tree_at(pool, node);
+    tree_update(pool, node);
+    int balance = (int)tree_height(pool, n->left) - (int)tree_height(pool, n->right);
+    if (balance > 1) {
+        tree_node *left = tree_at(pool, n->left);
+        if (tree_height(pool, left->left) < tree_height(pool, left->right)) {
+            n->left = tree_rotate_left(pool, n->left);
+        }
+        return tree_rotate_right(pool, node);
+    }
+    if (balance < -1) {
+        tree_node *right = tree_at(pool, n->right);
+        if (tree_height(pool, right->right) < tree_height(pool, right->left)) {
+            n->right = tree_rotate_right(pool, n->right);
+        }
+        return tree_rotate_left(pool, node);
+    }
+    return node;
+}
+
+static uint32_t tree_insert(mem_pool_t *pool, uint32_t root, uint32_t index) {
+    if (root == MEM_NIL) {
+        tree_node *n = tree_at(pool, index);
+        n->left = MEM_NIL;
+        n->right = MEM_NIL;
+        n->height = 1;
+        return index;
+    }
+    tree_node *r = tree_at(pool, root);
+    if (tree_less(pool, index, root)) {
+        r->left = tree_insert(pool, r->left, index);
+    } else {
+        r->right = tree_insert(pool, r->right, index);
+    }
+    return tree_balance(pool, root);
+}
+
+// Unlinks the leftmost node of a subtree into *min and returns the new subtree root
+static uint32_t tree_remove_min(mem_pool_t *pool, uint32_t root, uint32_t *min) {
+    tree_node *r = tree_at(pool, root);
+    if (r->left == MEM_NIL) {
+        *min = root;
+        return r->right;
+    }
+    r->left = tree_remove_min(pool, r->left, min);
+    return tree_balance(pool, root);
+}
+
+static uint32_t tree_remove(mem_pool_t *pool, uint32_t root, uint32_t index) {
+    tree_node *r = tree_at(pool, root);
+    if (root != index) {
+        if (tree_less(pool, index, root)) {
+            r->left = tree_remove(pool, r->left, index);
+        } else {
+            r->right = tree_remove(pool, r->right, index);
+        }
+        return tree_balance(pool, root);
+    }
+    if (r->left == MEM_NIL || r->right == MEM_NIL) {
+        return (r->left == MEM_NIL) ? r->right : r->left;
+    }
+    uint32_t successor;
+    uint32_t right = tree_remove_min(pool, r->right, &successor);
+    tree_at(pool, successor)->left = r->left;
+    tree_at(pool, successor)->right = right;
+    return tree_balance(pool, successor);
+}
+
+// Smallest free block of at least the given granules, lowest address first on ties
+static uint32_t tree_lower_bound(mem_pool_t *pool, uint32_t granules) {
+    uint32_t best = MEM_NIL;
+    for (uint32_t node = pool->free_tree; node != MEM_NIL;) {
+        pool->counters.search_steps++;
+        if (tag_size(pool, node) >= granules) {
+            best = node;
+            node = tree_at(pool, node)->left;
+        } else {
+            node = tree_at(pool, node)->right;
+        }
+    }
+    return best;
+}
+
+// Order of the smallest buddy block holding the given granules
+static int buddy_order(uint32_t granules) {
+    return (granules > 1) ? 32 - __builtin_clz(granules - 1) : 0;
+}
+
+static int free_list_class(mem_pool_t *pool, uint32_t granules) {
+    return (pool->backend == MEM_BACKEND_BUDDY) ? buddy_order(granules) : size_class(granules);
+}
+
+static void free_list_push(mem_pool_t *pool, uint32_t index, uint32_t granules) {
+    int class = free_list_class(pool, granules);
+    block_set(pool, index, granules, false);
+    pool->counters.free_granules += granules;
+    pool->counters.free_blocks++;
+    if (pool->backend == MEM_BACKEND_BITMAP) {
+        // Found through the free map instead; the run may now start below the hints of
+        // every class it can serve. Other runs are untouched, so a known longest stays known.
+        for (; class >= 0; class--) {
+            pool->run_hints[class] = (index / 64 < pool->run_hints[class]) ? index / 64 : pool->run_hints[class];
+        }
+        uint32_t *bound = &pool->run_bounds[index / 64 / RUN_GROUP_WORDS];
+        *bound = (granules > *bound) ? granules : *bound;
+        if (pool->longest_run != MEM_NIL && granules > pool->longest_run) {
+            pool->longest_run = granules;
+        }
+        return;
+    }
+    if (pool->placement == MEM_PLACEMENT_BEST_FIT) {
+        pool->free_tree = tree_insert(pool, pool->free_tree, index);
+        return;
+    }
+    free_block *node = free_node(pool, index);
+    node->prev = MEM_NIL;
+    node->next = pool->free_lists[class];
+    if (pool->free_lists[class] != MEM_NIL) {
+        free_node(pool, pool->free_lists[class])->prev = index;
+    }
+    pool->free_lists[class] = index;
+    pool->free_classes |= 1ULL << class;
+}
+
+static void free_list_remove(mem_pool_t *pool, uint32_t index) {
+    int class = free_list_class(pool, tag_size(pool, index));
+    pool->counters.free_granules -= tag_size(pool, index);
+    pool->counters.free_blocks--;
+    if (pool->backend == MEM_BACKEND_BITMAP) {
+        if (tag_size(pool, index) == pool->longest_run) {
+            pool->longest_run = MEM_NIL; // Maybe the only run that long
+        }
+        return;
+    }
+    if (pool->placement == MEM_PLACEMENT_BEST_FIT) {
+        pool->free_tree = tree_remove(pool, pool->free_tree, index);
+        return;
+    }
+    free_block *node = free_node(pool, index);
+    if (node->prev != MEM_NIL) {
+        free_node(pool, node->prev)->next = node->next;
+    } else {
+        pool->free_lists[class] = node->next;
+    }
+    if (node->next != MEM_NIL) {
+        free_node(pool, node->next)->prev = node->prev;
+    }
+    if (pool->free_lists[class] == MEM_NIL) {
+        pool->free_classes &= ~(1ULL << class);
+    }
+}
+
+// Buddy allocation: takes the smallest free block of a large enough order, splitting
+// off upper halves onto the lower order lists until it has the order required.
+// Block indices are multiples of their size, so the block is aligned as long as the
+// pool base is, which buddy pools ensure up to the page size.
+static uint32_t buddy_alloc(mem_pool_t *pool, uint32_t granules, size_t alignment) {
+    uintptr_t base_alignment = (uintptr_t)pool->memory_pool & -(uintptr_t)pool->memory_pool;
+    int order = buddy_order((granules > alignment / MEM_GRANULE) ? granules : alignment / MEM_GRANULE);
+    pool->counters.searches++;
+    uint64_t orders = pool->free_classes & (~0ULL << order);
+    if (!orders || alignment > base_alignment) {
+        return MEM_NIL;
+    }
+    pool->counters.search_steps++;
+    int found = __builtin_ctzll(orders);
+    uint32_t index = pool->free_lists[found];
+    free_list_remove(pool, index);
+    while (found > order) {
+        found--;
+        free_list_push(pool, index + (1u << found), 1u << found);
+    }
+    block_set(pool, index, 1u << order, true);
+    return index;
+}
+
+// Buddy release: merges the block with its buddy for as long as the buddy is free
+// and whole. A block's buddy always starts a block, so its tag tells both.
+static void buddy_release(mem_pool_t *pool, uint32_t index) {
+    uint32_t granules = tag_size(pool, index);
+    block_clear_start(pool, index);
+    while (granules < pool->pool_granules) {
+        uint32_t buddy = index ^ granules;
+        if (buddy >= pool->pool_granules || tag_used(pool, buddy) || tag_size(pool, buddy) != granules) {
+            break;
+        }
+        free_list_remove(pool, buddy);
+        index &= ~granules;
+        granules <<= 1;
+    }
+    free_list_push(pool, index, granules);
+}
+
+// Buddy resize in place: splits off upper halves to shrink, or absorbs free buddies
+// to grow while the block is the lower half. Returns false if it cannot grow.
+static bool buddy_resize(mem_pool_t *pool, uint32_t index, uint32_t granules) {
+    uint32_t size = tag_size(pool, index);
+    uint32_t target = 1u << buddy_order(granules);
+    if (target < pool->min_alignment / MEM_GRANULE) {
+        target = pool->min_alignment / MEM_GRANULE;
+    }
+    for (uint32_t step = size; step < target; step <<= 1) {
+        uint32_t buddy = index + step;
+        if ((index & step) || buddy >= pool->pool_granules || tag_used(pool, buddy) || tag_size(pool, buddy) != step) {
+            return false;
+        }
+    }
+    for (; size < target; size <<= 1) {
+        free_list_remove(pool, index + size);
+    }
+    for (; size > target; size >>= 1) {
+        free_list_push(pool, index + size / 2, size / 2);
+    }
+    block_set(pool, index, size, true);
+    return true;
+}
+
+// Carves granules [start, start + granules) out of the free block at index and marks
+// them used. Leftovers on either side go back on the free lists.
+static void block_carve(mem_pool_t *pool, uint32_t index, uint32_t start, uint32_t granules) {
+    uint32_t end = index + tag_size(pool, index);
+    free_list_remove(pool, index);
+    if (index < start) {
+        free_list_push(pool, index, start - index);
+    }
+    if (start + granules < end) {
+        free_list_push(pool, start + granules, end - start - granules);
+    }
+    block_set(pool, start, granules, true);
+    free_map_mark(pool, start, granules, false);
+    pool->rover = (start + granules < pool->pool_granules) ? start + granules : 0;
+}
+
+// Returns a block to the free lists, coalescing it with free neighbours
+static void block_release(mem_pool_t *pool, uint32_t index) {
+    if (pool->backend == MEM_BACKEND_BUDDY) {
+        buddy_release(pool, index);
+        return;
+    }
+    uint32_t granules = tag_size(pool, index);
+    block_clear_start(pool, index);
+    free_map_mark(pool, index, granules, true);
+    uint32_t next = index + granules;
+    if (next < pool->pool_granules && !tag_used(pool, next)) {
+        granules += tag_size(pool, next);
+        free_list_remove(pool, next);
+    }
+    if (index > 0 && !tag_used(pool, index - 1)) {
+        uint32_t prev = index - tag_size(pool, index - 1);
+        granules += tag_size(pool, prev);
+        free_list_remove(pool, prev);
+        index = prev;
+    }
+    free_list_push(pool, index, granules);
+}
+
+// Shrinks a used block to the given granules, returning the tail to the free lists
+static void block_truncate(mem_pool_t *pool, uint32_t index, uint32_t granules) {
+    uint32_t tail = index + granules;
+    uint32_t tail_granules = tag_size(pool, index) - granules;
+    block_set(pool, index, granules, true);
+    block_set(pool, tail, tail_granules, true);
+    block_release(pool, tail);
+}
+
+// Grows a used block to the given granules if the free block right after it has room
+static bool block_extend(mem_pool_t *pool, uint32_t index, uint32_t granules) {
+    uint32_t old_granules = tag_size(pool, index);
+    uint32_t next = index + old_granules;
+    if (next >= pool->pool_granules || tag_used(pool, next) || old_granules + tag_size(pool, next) < granules) {
+        return false;
+    }
+    uint32_t end = next + tag_size(pool, next);
+    free_list_remove(pool, next);
+    block_set(pool, index, granules, true);
+    free_map_mark(pool, next, index + granules - next, false);
+    if (index + granules < end) {
+        free_list_push(pool, index + granules, end - index - granules);
+    }
+    return true;
+}
+
+// Granules to skip from index so that a block starts on an alignment boundary
+static uint32_t align_padding(mem_pool_t *pool, uint32_t index, size_t alignment) {
+    uintptr_t addr = (uintptr_t)granule_ptr(pool, index);
+    uintptr_t aligned = (addr + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    return (aligned - addr) / MEM_GRANULE;
+}
+
+// Next-fit search: walks the blocks in address order from the rover, wrapping around
+// at the end of the pool, for the first free one that fits at the given alignment
+static uint32_t next_fit_find(mem_pool_t *pool, uint32_t granules, size_t alignment) {
+    if (pool->pool_granules == 0) {
+        return MEM_NIL;
+    }
+    uint32_t index = pool->rover;
+    do {
+        pool->counters.search_steps++;
+        if (!tag_used(pool, index) && tag_size(pool, index) >= (size_t)granules + align_padding(pool, index, alignment)) {
+            return index;
+        }
+        index += tag_size(pool, index);
+        if (index >= pool->pool_granules) {
+            index = 0;
+        }
+    } while (index != pool->rover);
+    return MEM_NIL;
+}
+
+// Finds a free block that holds the given granules at an aligned start by visiting
+// the tree in size order, starting from the smallest block that could fit
+static uint32_t tree_find_aligned(mem_pool_t *pool, uint32_t node, uint32_t granules, size_t alignment) {
+    if (node == MEM_NIL) {
+        return MEM_NIL;
+    }
+    pool->counters.search_steps++;
+    tree_node *n = tree_at(pool, node);
+    if (tag_size(pool, node) < granules) {
+        return tree_find_aligned(pool, n->right, granules, alignment);
+    }
+    uint32_t found = tree_find_aligned(pool, n->left, granules, alignment);
+    if (found != MEM_NIL) {
+        return found;
+    }
+    if (tag_size(pool, node) >= (size_t)granules + align_padding(pool, node, alignment)) {
+        return node;
+    }
+    return tree_find_aligned(pool, n->right, granules, alignment);
+}
+
+// First fit by address in a bitmap pool. Free blocks are always coalesced, so every
+// run of free bits is one block. The search starts from the class's hint, and when
+// the request is the smallest size of its class the hint moves up to where it ended;
+// allocations only shorten runs, so the hints stay valid until a block is freed.
+// From there it skips the groups of the map whose bound rules the request out and
+// lowers the bound of each group it scans in vain.
+static uint32_t bitmap_find(mem_pool_t *pool, uint32_t granules) {
+    int class = size_class(granules);
+    uint32_t words = (pool->pool_granules + 63) / 64;
+    uint32_t from = pool->run_hints[class];
+    uint32_t reach = (granules + 63) / 64; // Words past its group a run starting there may need
+    uint32_t index = MEM_NIL;
+    for (uint32_t group = from / RUN_GROUP_WORDS; index == MEM_NIL && group * RUN_GROUP_WORDS < words; group++) {
+        if (pool->run_bounds[group] < granules) {
+            continue;
+        }
+        pool->counters.search_steps++;
+        uint32_t first = (from > group * RUN_GROUP_WORDS) ? from : group * RUN_GROUP_WORDS;
+        uint32_t end = (group + 1) * RUN_GROUP_WORDS;
+        uint32_t last = (end + reach < words) ? end + reach : words;
+        uint32_t found = mem_bitmap_find_run(pool->free_map + first, last - first, granules);
+        if (found != MEM_NIL && first * 64 + found < end * 64) {
+            index = first * 64 + found;
+        } else {
+            pool->run_bounds[group] = granules - 1;
+        }
+    }
+    if (granules == 1 || size_class(granules - 1) != class) {
+        pool->run_hints[class] = (index != MEM_NIL) ? index / 64 : words;
+    }
+    return index;
+}
+
+// Finds a free block of at least the given granules according to the pool's placement.
+// Segregated fit (the default) takes the first fit within the request's own class,
+// otherwise the head of the next non-empty class, whose blocks all fit. It is a good
+// fit, not first fit by address: each list holds the most recently freed block first.
+static uint32_t free_list_find(mem_pool_t *pool, uint32_t granules) {
+    int class = size_class(granules);
+    pool->counters.searches++;
+    if (pool->backend == MEM_BACKEND_BITMAP) {
+        return bitmap_find(pool, granules);
+    }
+    if (pool->placement == MEM_PLACEMENT_BEST_FIT) {
+        return tree_lower_bound(pool, granules);
+    }
+    if (pool->placement == MEM_PLACEMENT_NEXT_FIT) {
+        return next_fit_find(pool, granules, MEM_GRANULE);
+    }
+    if (pool->free_classes & (1ULL << class)) {
+        for (uint32_t walker = pool->free_lists[class]; walker != MEM_NIL; walker = free_node(pool, walker)->next) {
+            pool->counters.search_steps++;
+            if (tag_size(pool, walker) >= granules) {
+                return walker;
+            }
+        }
+    }
+    uint64_t larger = (class + 1 < MEM_NUM_CLASSES) ? pool->free_classes & (~0ULL << (class + 1)) : 0;
+    if (!larger) {
+        return MEM_NIL;
+    }
+    pool->counters.search_steps++;
+    return pool->free_lists[__builtin_ctzll(larger)];
+}
+
+// Finds a free block that holds the given granules at an aligned start. Any block
+// covering the worst-case padding fits; failing that, the free blocks are scanned for
+// a smaller one that happens to be suitably placed.
+static uint32_t free_list_find_aligned(mem_pool_t *pool, uint32_t granules, size_t alignment) {
+    if (pool->placement == MEM_PLACEMENT_NEXT_FIT) {
+        pool->counters.searches++;
+        return next_fit_find(pool, granules, alignment);
+    }
+    // Enough for any start, sized in size_t so that a wide alignment cannot wrap it
+    size_t padded = (size_t)granules + alignment / MEM_GRANULE - 1;
+    uint32_t index = (padded <= pool->pool_granules) ? free_list_find(pool, padded) : MEM_NIL;
+    if (index != MEM_NIL || pool->backend == MEM_BACKEND_BITMAP) {
+        return index;
+    }
+    if (pool->placement == MEM_PLACEMENT_BEST_FIT) {
+        return tree_find_aligned(pool, pool->free_tree, granules, alignment);
+    }
+    for (int class = size_class(granules); class < MEM_NUM_CLASSES; class++) {
+        for (uint32_t walker = pool->free_lists[class]; walker != MEM_NIL; walker = free_node(pool, walker)->next) {
+            pool->counters.search_steps++;
+            if (tag_size(pool, walker) >= (size_t)granules + align_padding(pool, walker, alignment)) {
+                return walker;
+            }
+        }
+    }
+    return MEM_NIL;
+}
+
+// Maps a pointer to its granule index, or MEM_NIL if it cannot start a block
+static uint32_t granule_index(mem_pool_t *pool, void *ptr) {
+    if ((char *)ptr < (char *)pool->memory_pool) {
+        return MEM_NIL;
+    }
+    size_t offset = (char *)ptr - (char *)pool->memory_pool;
+    if (offset % MEM_GRANULE != 0 || offset / MEM_GRANULE >= pool->pool_granules) {
+        return MEM_NIL;
+    }
+    return offset / MEM_GRANULE;
+}
+
+// Finds the used block starting at ptr through the block-start bitmap
+static uint32_t block_find(mem_pool_t *pool, void *ptr) {
+    uint32_t index = granule_index(pool, ptr);
+    return (index != MEM_NIL && block_is_start(pool, index)) ? index : MEM_NIL;
+}
+
+static inline bool region_is_start(mem_region_t *region, uint32_t index) {
+    uint32_t bit = index - region->base;
+    return __atomic_load_n(&region->starts[bit / 64], __ATOMIC_ACQUIRE) & (1ULL << (bit % 64));
+}
+
+static inline void region_mark_start(mem_region_t *region, uint32_t index) {
+    uint32_t bit = index - region->base;
+    __atomic_fetch_or(&region->starts[bit / 64], 1ULL << (bit % 64), __ATOMIC_RELEASE);
+}
+
+static inline bool region_claim_start(mem_region_t *region, uint32_t index) {
+    uint32_t bit = index - region->base;
+    uint64_t mask = 1ULL << (bit % 64);
+    return __atomic_fetch_and(&region->starts[bit / 64], ~mask, __ATOMIC_ACQ_REL) & mask;
+}
+
+// Granules a region allocation takes: its size rounded up to the bottom of a size class
+static uint64_t region_granules(uint32_t granules) {
+    if (granules <= MEM_EXACT_CLASSES) {
+        return granules;
+    }
+    return 1ULL << (32 - __builtin_clz(granules - 1));
+}
+
+static void region_stack_push(mem_region_t *region, int class, uint32_t index) {
+    uint32_t *link = granule_ptr(region->pool, index);
+    uint64_t head = __atomic_load_n(&region->free_stacks[class], __ATOMIC_RELAXED);
+    uint64_t next;
+    do {
+        __atomic_store_n(link, (uint32_t)head, __ATOMIC_RELAXED);
+        next = ((head >> 32) + 1) << 32 | index;
+    } while (!__atomic_compare_exchange_n(&region->free_stacks[class], &head, next, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static uint32_t region_stack_pop(mem_region_t *region, int class) {
+    uint64_t head = __atomic_load_n(&region->free_stacks[class], __ATOMIC_ACQUIRE);
+    while ((uint32_t)head != MEM_NIL) {
+        // The block may be popped and reused by another thread meanwhile; the CAS
+        // then fails on the version and the stale link is never used
+        uint32_t link = __atomic_load_n((uint32_t *)granule_ptr(region->pool, (uint32_t)head), __ATOMIC_RELAXED);
+        uint64_t next = ((head >> 32) + 1) << 32 | link;
+        if (__atomic_compare_exchange_n(&region->free_stacks[class], &head, next, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return (uint32_t)head;
+        }
+    }
+    return MEM_NIL;
+}
+
+// Allocation function: pops a recycled block of the size class or bumps the top of
+// the region, without locks. Blocks above the pool's minimum alignment are always bumped.
+static void* region_alloc(mem_region_t *region, uint32_t granules, size_t alignment) {
+    mem_pool_t *pool = region->pool;
+    uint64_t rounded = region_granules(granules);
+    if (rounded > region->end - region->base) {
+        return NULL;
+    }
+    int class = size_class(rounded);
+    uint32_t index = (alignment <= pool->min_alignment) ? region_stack_pop(region, class) : MEM_NIL;
+    if (index == MEM_NIL && alignment <= pool->min_alignment) {
+        uint64_t start = __atomic_fetch_add(&region->top, rounded, __ATOMIC_RELAXED);
+        if (start + rounded > region->end) {
+            return NULL;
+        }
+        index = start;
+    } else if (index == MEM_NIL) {
+        uint64_t top = __atomic_load_n(&region->top, __ATOMIC_RELAXED);
+        uint64_t start;
+        do {
+            if (top >= region->end) {
+                return NULL;
+            }
+            start = top + align_padding(pool, top, alignment);
+            if (start + rounded > region->end) {
+                return NULL;
+            }
+        } while (!__atomic_compare_exchange_n(&region->top, &top, start + rounded, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        index = start;
+    }
+    pool->block_tags[index] = (rounded << TAG_SHIFT) | TAG_USED;
+    region_mark_start(region, index);
+    return granule_ptr(pool, index);
+}
+
+// Deallocation function: pushes a block of the region onto its class's free stack.
+// Returns false for foreign and already freed pointers, which are ignored.
+static bool region_free(mem_region_t *region, void *ptr) {
+    mem_pool_t *pool = region->pool;
+    uint32_t index = granule_index(pool, ptr);
+    if (index == MEM_NIL || index < region->base || index >= region->end || !region_claim_start(region, index)) {
+        return false;
+    }
+    region_stack_push(region, size_class(tag_size(pool, index)), index);
+    return true;
+}
+
+// Region operations as seen by the pool-wide counters of a lock-free pool
+
+static void* region_alloc_counted(mem_region_t *region, uint32_t granules, size_t alignment) {
+    void *ptr = region_alloc(region, granules, alignment);
+    if (ptr) {
+        REGION_COUNT(region, allocs);
+    } else {
+        REGION_COUNT(region, failed_allocs);
+    }
+    return ptr;
+}
+
+static void region_free_counted(mem_region_t *region, void *ptr) {
+    if (region_free(region, ptr)) {
+        REGION_COUNT(region, frees);
+    }
+}
+
+// Forgets every allocation of the region: clears their start bits and empties the stacks
+static void region_clear(mem_region_t *region) {
+    for (size_t word = 0; word < ((size_t)region->end - region->base + 63) / 64; word++) {
+        __atomic_store_n(&region->starts[word], 0, __ATOMIC_RELEASE);
+    }
+    for (int class = 0; class < MEM_NUM_CLASSES; class++) {
+        __atomic_store_n(&region->free_stacks[class], REGION_STACK_EMPTY, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&region->top, region->base, __ATOMIC_RELEASE);
+}
+
+// Creates a region over [base, end) with the given start bitmap, or with a bitmap of
+// its own allocated along with it when starts is NULL
+static mem_region_t *region_new(mem_pool_t *pool, uint32_t base, uint32_t end, uint64_t *starts) {
+    size_t words = starts ? 0 : ((size_t)end - base + 63) / 64;
+    mem_region_t *region = calloc(1, sizeof(*region) + words * sizeof(uint64_t));
+    if (region) {
+        region->pool = pool;
+        region->base = base;
+        region->end = end;
+        region->starts = starts ? starts : (uint64_t *)(region + 1);
+        region_clear(region);
+    }
+    return region;
+}
+
+// Returns the cached blocks of one class to the pool, caller holds memory_lock
+static void cache_flush_class(thread_cache *cache, int class, uint32_t count) {
+    while (count-- > 0 && cache->bins[class]) {
+        void *ptr = cache->bins[class];
+        cache->bins[class] = *(void **)ptr;
+        cache->counts[class]--;
+        block_release(cache->pool, granule_index(cache->pool, ptr));
+    }
+}
+
+static void cache_flush_all(thread_cache *cache) {
+    for (int class = 0; class < MEM_EXACT_CLASSES; class++) {
+        cache_flush_class(cache, class, cache->counts[class]);
+    }
+}
+
+static void cache_stats_add(struct mem_cache_stats *total, const struct mem_cache_stats *stats) {
+    total->alloc_hits += __atomic_load_n(&stats->alloc_hits, __ATOMIC_RELAXED);
+    total->alloc_misses += __atomic_load_n(&stats->alloc_misses, __ATOMIC_RELAXED);
+    total->free_hits += __atomic_load_n(&stats->free_hits, __ATOMIC_RELAXED);
+    total->free_misses += __atomic_load_n(&stats->free_misses, __ATOMIC_RELAXED);
+    total->refills += __atomic_load_n(&stats->refills, __ATOMIC_RELAXED);
+    total->flushes += __atomic_load_n(&stats->flushes, __ATOMIC_RELAXED);
+}
+
+// Thread exit handler: hands the cached blocks and counters back to the pool
+static void cache_destroy(void *arg) {
+    thread_cache *cache = arg;
+    mem_pool_t *pool = cache->pool;
+    pool_lock(pool);
+    cache_flush_all(cache);
+    cache_stats_add(&pool->retired_cache_stats, &cache->stats);
+    if (cache->prev) {
+        cache->prev->next = cache->next;
+    } else {
+        pool->caches = cache->next;
+    }
+    if (cache->next) {
+        cache->next->prev = cache->prev;
+    }
+    pool_unlock(pool);
+    free(cache);
+}
+
+// Returns the calling thread's cache, creating it on first use, or NULL when caching is off
+static thread_cache *cache_get(mem_pool_t *pool) {
+    if (__atomic_load_n(&pool->cache_capacity, __ATOMIC_ACQUIRE) == 0) {
+        return NULL; // Also while there is no key yet
+    }
+    thread_cache *cache = pthread_getspecific(pool->cache_key);
+    if (cache) {
+        return cache;
+    }
+    cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+    cache->pool = pool;
+    pool_lock(pool);
+    cache->next = pool->caches;
+    if (pool->caches) {
+        pool->caches->prev = cache;
+    }
+    pool->caches = cache;
+    pool_unlock(pool);
+    pthread_setspecific(pool->cache_key, cache);
+    return cache;
+}
+
+// Sets one chunk's cache capacity, creating its cache key the first time caching is
+// turned on. Returns false, leaving caching off, if the process has no key left.
+// Turning caching off hands the calling thread's cached blocks back at once.
+static bool chunk_set_cache_capacity(mem_pool_t *pool, size_t capacity) {
+    pool_lock(pool);
+    if (capacity > 0 && !pool->has_cache_key) {
+        pool->has_cache_key = pthread_key_create(&pool->cache_key, cache_destroy) == 0;
+    }
+    bool set = capacity == 0 || pool->has_cache_key;
+    __atomic_store_n(&pool->cache_capacity, set ? capacity : 0, __ATOMIC_RELEASE);
+    thread_cache *cache = (capacity == 0 && pool->has_cache_key) ? pthread_getspecific(pool->cache_key) : NULL;
+    if (cache) {
+        cache_flush_all(cache);
+    }
+    pool_unlock(pool);
+    return set;
+}
+
+// Reserves total bytes of address space without committing it. Explicit huge pages
+// fall back to transparent ones, which fall back to normal pages; returns NULL if
+// mmap fails altogether so the caller can fall back to the heap.
+static void *pool_map(mem_pool_t *pool, size_t total, enum mem_huge_pages huge_pages) {
+#ifdef MAP_HUGETLB
+    if (huge_pages == MEM_HUGE_PAGES_EXPLICIT) {
+        // No MAP_NORESERVE here: hugetlb pages must be reserved up front, or touching
+        // one that the system cannot supply raises SIGBUS instead of failing the mmap
+        size_t length = round_up(total, HUGE_PAGE_SIZE);
+        void *mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mapping != MAP_FAILED) {
+            pool->huge_pages = MEM_HUGE_PAGES_EXPLICIT;
+            pool->mapping_size = length;
+            return mapping;
+        }
+    }
+#endif
+    size_t length = round_up(total, sysconf(_SC_PAGESIZE));
+    // Transparent huge pages need a huge-page-aligned range, so reserve extra and trim
+    size_t slack = (huge_pages != MEM_HUGE_PAGES_NONE) ? HUGE_PAGE_SIZE : 0;
+    char *mapping = mmap(NULL, length + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    if (slack) {
+        char *aligned = (char *)round_up((uintptr_t)mapping, HUGE_PAGE_SIZE);
+        if (aligned > mapping) {
+            munmap(mapping, aligned - mapping);
+        }
+        if (aligned + length < mapping + length + slack) {
+            munmap(aligned + length, mapping + length + slack - (aligned + length));
+        }
+        mapping = aligned;
+    }
+    pool->huge_pages = MEM_HUGE_PAGES_NONE;
+#ifdef MADV_HUGEPAGE
+    if (slack && madvise(mapping, length, MADV_HUGEPAGE) == 0) {
+        pool->huge_pages = MEM_HUGE_PAGES_TRANSPARENT;
+    }
+#endif
+    pool->mapping_size = length;
+    return mapping;
+}
+
+static void pool_unmap(mem_pool_t *pool) {
+    if (pool->borrowed) {
+        return;
+    } else if (pool->backing == MEM_BACKING_FILE) {
+        msync(pool->file_header, pool->mapping_size, MS_SYNC);
+        munmap(pool->file_header, pool->mapping_size);
+    } else if (pool->backing == MEM_BACKING_MMAP) {
+        munmap(pool->memory_pool, pool->mapping_size);
+    } else {
+        free(pool->memory_pool);
+    }
+}
+
+// Rebuilds the free lists of a reopened file-backed pool by walking its blocks in
+// address order. Used blocks whose start bit is clear were sitting in a thread cache
+// or region when the pool was closed and are reclaimed along with the free ones.
+// Live blocks count as allocations, so the statistics see them as in use. With verify,
+// for a file that was not closed cleanly, a block whose last tag or start bits disagree
+// with its first tag, as a crash in the middle of a split or merge leaves it, fails too.
+static bool pool_rebuild(mem_pool_t *pool, bool verify) {
+    uint32_t run = MEM_NIL;
+    uint32_t index = 0;
+    uint32_t live_blocks = 0;
+    while (index < pool->pool_granules) {
+        uint32_t granules = tag_size(pool, index);
+        if (granules == 0 || granules > pool->pool_granules - index) {
+            return false; // Corrupt tags
+        }
+        uint32_t head = pool->block_tags[index];
+        uint32_t foot = pool->block_tags[index + granules - 1];
+        if (verify && ((head & TAG_EXT) ? !(head & TAG_USED) || !(foot & TAG_USED) : foot != head)) {
+            return false;
+        }
+        bool live = tag_used(pool, index) && block_is_start(pool, index);
+        if (live) {
+            pool->counters.allocs++;
+            live_blocks++;
+        }
+        if (!live && run == MEM_NIL) {
+            run = index;
+        } else if (live && run != MEM_NIL) {
+            free_list_push(pool, run, index - run);
+            run = MEM_NIL;
+        }
+        index += granules;
+    }
+    if (run != MEM_NIL) {
+        free_list_push(pool, run, pool->pool_granules - run);
+    }
+    if (verify) {
+        // Start bits may only mark the first granule of a used block
+        uint32_t starts = 0;
+        for (uint32_t word = 0; word < (pool->pool_granules + 63) / 64; word++) {
+            starts += __builtin_popcountll(pool->block_starts[word]);
+        }
+        return starts == live_blocks;
+    }
+    return true;
+}
+
+// Sets up everything but the memory of a new pool, fresh when its memory holds no blocks yet
+static mem_pool_t *pool_init(mem_pool_t *pool, size_t size, const struct mem_pool_options *options, bool fresh) {
+    pool->size_of_pool = size;
+    memset(pool->free_lists, 0xff, sizeof(pool->free_lists));
+    memset(pool->run_hints, 0, sizeof(pool->run_hints));
+    pool->longest_run = 0;
+    pool->free_tree = MEM_NIL;
+    pool->free_handles = MEM_NIL;
+    pool->backend = options ? options->backend : MEM_BACKEND_FREE_LISTS;
+    pool->placement = (options && pool->backend == MEM_BACKEND_FREE_LISTS) ? options->placement : MEM_PLACEMENT_SEGREGATED;
+    if (pool->free_map) {
+        uint32_t words = (pool->pool_granules + 63) / 64;
+        pool->run_bounds = calloc(words / RUN_GROUP_WORDS + 1, sizeof(uint32_t));
+        if (!pool->run_bounds) {
+            pool_unmap(pool);
+            free(pool);
+            return NULL;
+        }
+    }
+    if (options && options->lock_free) {
+        pool->region = region_new(pool, 0, pool->pool_granules, pool->block_starts);
+        if (!pool->region) {
+            pool_unmap(pool);
+            free(pool);
+            return NULL;
+        }
+    } else if (!fresh) {
+        if (!pool_rebuild(pool, !pool->file_header->clean)) {
+            pool_unmap(pool);
+            free(pool);
+            return NULL;
+        }
+    } else if (pool->backend == MEM_BACKEND_BUDDY) {
+        // Split the pool into the largest buddy blocks that fit, each a multiple of its size
+        for (uint32_t index = 0; index < pool->pool_granules;) {
+            uint32_t granules = 1u << (31 - __builtin_clz(pool->pool_granules - index));
+            free_list_push(pool, index, granules);
+            index += granules;
+        }
+    } else if (pool->pool_granules > 0) {
+        free_list_push(pool, 0, pool->pool_granules);
+        free_map_mark(pool, 0, pool->pool_granules, true);
+    }
+    mem_lock_init(&pool->memory_lock, options ? options->lock : MEM_LOCK_PTHREAD);
+    if (options && options->growth_factor > 0 && !options->lock_free) {
+        pool->growable = true;
+        pool->growth_factor = options->growth_factor;
+        pool->max_size = options->max_size;
+        pool->chain_size = size;
+        pool->chunk_options = *options;
+        pool->chunk_options.growth_factor = 0;
+        pthread_rwlock_init(&pool->chain_lock, NULL);
+    }
+    return pool;
+}
+
+// Splits a new pool's memory into shards of whole bitmap words, the last one taking
+// what is left, and sets up a pool for each. Pools too small to split stay whole.
+static mem_pool_t *pool_shard(mem_pool_t *pool, const struct mem_pool_options *options) {
+    uint32_t granules = pool->pool_granules;
+    uint32_t unit = (pool->min_alignment / MEM_GRANULE > 64) ? pool->min_alignment / MEM_GRANULE : 64;
+    uint32_t shard_granules = round_up((granules + options->shards - 1) / options->shards, unit);
+    uint32_t count = (granules + shard_granules - 1) / shard_granules;
+    if (count <= 1) {
+        return pool_init(pool, (size_t)granules * MEM_GRANULE, options, true);
+    }
+    mem_pool_t **shards = calloc(count, sizeof(*shards));
+    if (!shards) {
+        pool_unmap(pool);
+        free(pool);
+        return NULL;
+    }
+    pool->pool_granules = shard_granules;
+    if (!pool_init(pool, (size_t)shard_granules * MEM_GRANULE, options, true)) {
+        free(shards);
+        return NULL;
+    }
+    pool->shards = shards;
+    pool->shard_count = count;
+    pool->shard_bytes = (size_t)shard_granules * MEM_GRANULE;
+    shards[0] = pool;
+
+    struct mem_pool_options shard_options = *options;
+    shard_options.shards = 0;
+    for (uint32_t i = 1; i < count; i++) {
+        mem_pool_t *shard = calloc(1, sizeof(*shard));
+        if (!shard) {
+            mem_pool_destroy(pool);
+            return NULL;
+        }
+        uint32_t first = i * shard_granules;
+        shard->borrowed = true;
+        shard->backing = pool->backing;
+        shard->huge_pages = pool->huge_pages;
+        shard->min_alignment = pool->min_alignment;
+        shard->memory_pool = granule_ptr(pool, first);
+        shard->pool_granules = (granules - first < shard_granules) ? granules - first : shard_granules;
+        shard->block_starts = pool->block_starts + first / 64;
+        shard->free_map = pool->free_map ? pool->free_map + first / 64 : NULL;
+        shard->block_tags = pool->block_tags + first;
+        if (!pool_init(shard, (size_t)shard->pool_granules * MEM_GRANULE, &shard_options, true)) {
+            mem_pool_destroy(pool);
+            return NULL;
+        }
+        shards[i - 1]->next_chunk = shard;
+        shards[i] = shard;
+    }
+    return pool;
+}
+
+// Creation function: creates an independent memory pool of the given size, options may be NULL
+mem_pool_t *mem_pool_create_ex(size_t size, const struct mem_pool_options *options) {
+    size_t min_alignment = (options && options->min_alignment > MEM_ALIGN_DEFAULT) ? options->min_alignment : MEM_ALIGN_DEFAULT;
+    if ((min_alignment & (min_alignment - 1)) != 0 || size > (size_t)MEM_MAX_GRANULES * MEM_GRANULE ||
+        round_up(size, min_alignment) / MEM_GRANULE > MEM_MAX_GRANULES) {
+        return NULL;
+    }
+    mem_pool_t *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->min_alignment = min_alignment;
+    size_t rounded = round_up(size, min_alignment);
+    pool->pool_granules = rounded / MEM_GRANULE;
+    size_t bitmap_size = ((size_t)pool->pool_granules + 63) / 64 * sizeof(uint64_t);
+    bool bitmap = options && options->backend == MEM_BACKEND_BITMAP && !options->lock_free;
+    size_t maps_size = bitmap ? 2 * bitmap_size : bitmap_size; // The free map follows the start bitmap
+    size_t total = rounded + maps_size + (size_t)pool->pool_granules * sizeof(uint32_t);
+    if (options && options->backing == MEM_BACKING_MMAP && min_alignment <= (size_t)sysconf(_SC_PAGESIZE)) {
+        pool->memory_pool = pool_map(pool, total ? total : min_alignment, options->huge_pages);
+        pool->backing = pool->memory_pool ? MEM_BACKING_MMAP : MEM_BACKING_HEAP;
+    }
+    size_t base_alignment = min_alignment;
+    if (options && options->backend == MEM_BACKEND_BUDDY && base_alignment < MEM_ALIGN_PAGE) {
+        base_alignment = MEM_ALIGN_PAGE; // Buddy blocks are only as aligned as the pool base
+    }
+    if (pool->backing == MEM_BACKING_HEAP && posix_memalign(&pool->memory_pool, base_alignment, total ? total : min_alignment) != 0) {
+        free(pool);
+        return NULL;
+    }
+    pool->block_starts = (uint64_t *)((char *)pool->memory_pool + rounded);
+    pool->free_map = bitmap ? (uint64_t *)((char *)pool->block_starts + bitmap_size) : NULL;
+    pool->block_tags = (uint32_t *)((char *)pool->block_starts + maps_size);
+    if (pool->backing == MEM_BACKING_HEAP) {
+        memset(pool->block_starts, 0, maps_size); // Fresh mappings are already zeroed
+    }
+    if (options && options->shards > 1 && !options->lock_free && options->growth_factor <= 0) {
+        return pool_shard(pool, options);
+    }
+    return pool_init(pool, size, options, true);
+}
+
+mem_pool_t *mem_pool_create(size_t size) {
+    return mem_pool_create_ex(size, NULL);
+}
+
+// Creation function: maps the file at path as a persistent pool, creating it with the
+// given size if it is empty or missing. Reopening takes the stored size, so size may
+// be 0, and the blocks allocated before are found intact. Pools of a file neither
+// grow nor run lock-free.
+mem_pool_t *mem_pool_open_file(const char *path, size_t size, const struct mem_pool_options *options) {
+    size_t min_alignment = (options && options->min_alignment > MEM_ALIGN_DEFAULT) ? options->min_alignment : MEM_ALIGN_DEFAULT;
+    if ((min_alignment & (min_alignment - 1)) != 0 || min_alignment > FILE_HEADER_SIZE) {
+        return NULL;
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    bool fresh = st.st_size == 0;
+    if (!fresh) {
+        // An existing file keeps its size and alignment, options may only repeat them
+        struct file_header header;
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) != 0 ||
+            (options && options->min_alignment > MEM_ALIGN_DEFAULT && header.min_alignment != min_alignment) || (size && size != header.size)) {
+            close(fd);
+            return NULL;
+        }
+        size = header.size;
+        min_alignment = header.min_alignment;
+        if ((min_alignment & (min_alignment - 1)) != 0 || min_alignment < MEM_ALIGN_DEFAULT || min_alignment > FILE_HEADER_SIZE) {
+            close(fd);
+            return NULL;
+        }
+    }
+    if (size > (size_t)MEM_MAX_GRANULES * MEM_GRANULE || round_up(size, min_alignment) / MEM_GRANULE > MEM_MAX_GRANULES) {
+        close(fd);
+        return NULL;
+    }
+    size_t rounded = round_up(size, min_alignment);
+    size_t granules = rounded / MEM_GRANULE;
+    size_t bitmap_size = (granules + 63) / 64 * sizeof(uint64_t);
+    size_t length = FILE_HEADER_SIZE + rounded + bitmap_size + granules * sizeof(uint32_t);
+    if ((fresh && ftruncate(fd, length) != 0) || (!fresh && (size_t)st.st_size < length)) {
+        close(fd);
+        return NULL;
+    }
+    void *mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    mem_pool_t *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        munmap(mapping, length);
+        return NULL;
+    }
+    pool->backing = MEM_BACKING_FILE;
+    pool->file_header = mapping;
+    pool->mapping_size = length;
+    pool->min_alignment = min_alignment;
+    pool->memory_pool = (char *)mapping + FILE_HEADER_SIZE;
+    pool->pool_granules = granules;
+    pool->block_starts = (uint64_t *)((char *)pool->memory_pool + rounded);
+    pool->block_tags = (uint32_t *)((char *)pool->block_starts + bitmap_size);
+    if (fresh) {
+        memcpy(pool->file_header->magic, FILE_MAGIC, sizeof(pool->file_header->magic));
+        pool->file_header->size = size;
+        pool->file_header->min_alignment = min_alignment;
+    }
+
+    struct mem_pool_options file_options = {0};
+    if (options) {
+        file_options = *options;
+    }
+    file_options.lock_free = false;
+    file_options.growth_factor = 0;
+    file_options.shards = 0;
+    file_options.backend = MEM_BACKEND_FREE_LISTS; // Reopening rebuilds coalesced free lists
+    pool = pool_init(pool, size, &file_options, fresh);
+    if (pool) {
+        pool->file_header->clean = 0; // Until closed; a refused file keeps its flag
+    }
+    return pool;
+}
+
+// Persistence: the root slot of a file-backed pool, where a restarted process finds
+// its first structure. Pointers stored inside the pool should be offsets.
+void mem_pool_set_root(mem_pool_t *pool, void *root) {
+    if (pool->file_header) {
+        pool->file_header->root = root ? mem_pool_offset(pool, root) + 1 : 0;
+    }
+}
+
+void* mem_pool_get_root(mem_pool_t *pool) {
+    if (!pool->file_header || pool->file_header->root == 0) {
+        return NULL;
+    }
+    return mem_pool_pointer(pool, pool->file_header->root - 1);
+}
+
+size_t mem_pool_offset(mem_pool_t *pool, void *ptr) {
+    return (char *)ptr - (char *)pool->memory_pool;
+}
+
+void* mem_pool_pointer(mem_pool_t *pool, size_t offset) {
+    return (char *)pool->memory_pool + offset;
+}
+
+// Checkpoint: flushes a file-backed pool to disk, so a system crash loses nothing
+// written before. Returns 0 on success, -1 on failure or for other pools.
+int mem_pool_checkpoint(mem_pool_t *pool) {
+    if (!pool->file_header) {
+        return -1;
+    }
+    pool_lock(pool);
+    int result = msync(pool->file_header, pool->mapping_size, MS_SYNC);
+    pool_unlock(pool);
+    return result;
+}
+
+// Allocation function: takes a block of the given granules from the segregated free
+// lists, starting at a multiple of alignment, caller holds memory_lock
+static void* block_alloc(mem_pool_t *pool, uint32_t granules, size_t alignment) {
+    if (pool->backend == MEM_BACKEND_BUDDY) {
+        uint32_t index = buddy_alloc(pool, granules, alignment);
+        return (index != MEM_NIL) ? granule_ptr(pool, index) : NULL;
+    }
+    if (alignment <= pool->min_alignment) {
+        uint32_t index = free_list_find(pool, granules);
+        if (index == MEM_NIL) {
+            return NULL;
+        }
+        block_carve(pool, index, index, granules);
+        return granule_ptr(pool, index);
+    }
+    if (granules < 2) {
+        granules = 2; // Room for the alignment in the last tag
+    }
+    uint32_t index = free_list_find_aligned(pool, granules, alignment);
+    if (index == MEM_NIL) {
+        return NULL;
+    }
+    uint32_t start = index + align_padding(pool, index, alignment);
+    block_carve(pool, index, start, granules);
+    block_set_alignment(pool, start, alignment);
+    return granule_ptr(pool, start);
+}
+
+// Allocation function: as block_alloc, but when the pool is exhausted the blocks parked
+// in the caller's thread cache are given back first, caller holds memory_lock
+static void* block_alloc_or_flush(mem_pool_t *pool, uint32_t granules, size_t alignment, thread_cache *cache) {
+    void *ptr = block_alloc(pool, granules, alignment);
+    if (!ptr && cache) {
+        cache_flush_all(cache);
+        ptr = block_alloc(pool, granules, alignment);
+    }
+    return ptr;
+}
+
+// Allocation function: serves a small block from the thread cache, refilling it in a batch on a miss
+static void* cache_alloc(thread_cache *cache, size_t size) {
+    mem_pool_t *pool = cache->pool;
+    uint32_t granules = size_to_granules(pool, size);
+    int class = granules - 1;
+    void *ptr = cache->bins[class];
+    if (ptr) {
+        cache->bins[class] = *(void **)ptr;
+        cache->counts[class]--;
+        block_mark_start(pool, granule_index(pool, ptr));
+        CACHE_COUNT(cache, alloc_hits);
+        return ptr;
+    }
+    CACHE_COUNT(cache, alloc_misses);
+
+    pool_lock(pool);
+    ptr = block_alloc_or_flush(pool, granules, pool->min_alignment, cache);
+    count_alloc(pool, ptr);
+    uint32_t batch = (pool->cache_capacity < CACHE_BATCH) ? pool->cache_capacity : CACHE_BATCH;
+    for (uint32_t i = 1; ptr && i < batch; i++) {
+        void *extra = block_alloc(pool, granules, pool->min_alignment);
+        if (!extra) {
+            break;
+        }
+        block_clear_start(pool, granule_index(pool, extra));
+        *(void **)extra = cache->bins[class];
+        cache->bins[class] = extra;
+        cache->counts[class]++;
+    }
+    pool_unlock(pool);
+    if (ptr) {
+        CACHE_COUNT(cache, refills);
+    }
+    return ptr;
+}
+
+// Allocation function: finds a free block that fits the requested size
+static void* pool_alloc(mem_pool_t *pool, size_t size) {
+    if (size > pool->size_of_pool) {
+        return NULL; // Cannot allocate more than the pool size
+    }
+    if (size == 0) {
+        return pool->memory_pool; // Return the start of the memory pool
+    }
+    if (pool->region) {
+        return region_alloc_counted(pool->region, size_to_granules(pool, size), pool->min_alignment);
+    }
+    thread_cache *cache = cache_get(pool);
+    if (cache && size_to_granules(pool, size) <= MEM_EXACT_CLASSES) {
+        return cache_alloc(cache, size);
+    }
+    pool_lock(pool);
+    void *ptr = block_alloc_or_flush(pool, size_to_granules(pool, size), pool->min_alignment, cache);
+    count_alloc(pool, ptr);
+    pool_unlock(pool);
+    return ptr;
+}
+
+// Allocation function: as mem_pool_alloc, but the block starts at a multiple of
+// alignment, which must be a power of two. mem_pool_resize keeps the alignment.
+static void* pool_alloc_aligned(mem_pool_t *pool, size_t size, size_t alignment) {
+    if (alignment <= pool->min_alignment) {
+        return pool_alloc(pool, size);
+    }
+    if ((alignment & (alignment - 1)) != 0 || size > pool->size_of_pool || alignment > pool->size_of_pool) {
+        return NULL;
+    }
+    uint32_t granules = size_to_granules(pool, size ? size : 1);
+    if (pool->region) {
+        return region_alloc_counted(pool->region, granules, alignment);
+    }
+    thread_cache *cache = cache_get(pool);
+    pool_lock(pool);
+    void *ptr = block_alloc_or_flush(pool, granules, alignment, cache);
+    count_alloc(pool, ptr);
+    pool_unlock(pool);
+    return ptr;
+}
+
+// Batch allocation function: allocates count blocks of the given size under a single
+// lock, carving them back to back out of as few free blocks as possible. Returns how
+// many were allocated; the rest of out_ptrs is set to NULL.
+static size_t pool_alloc_batch(mem_pool_t *pool, size_t size, size_t count, void **out_ptrs) {
+    if (size > pool->size_of_pool) {
+        count = 0;
+    }
+    if (size == 0) {
+        for (size_t i = 0; i < count; i++) {
+            out_ptrs[i] = pool->memory_pool; // As mem_pool_alloc(pool, 0)
+        }
+        return count;
+    }
+    uint32_t granules = size_to_granules(pool, size);
+    size_t done = 0;
+    if (pool->region) {
+        while (done < count && (out_ptrs[done] = region_alloc_counted(pool->region, granules, pool->min_alignment))) {
+            done++;
+        }
+        for (size_t i = done; i < count; i++) {
+            out_ptrs[i] = NULL;
+        }
+        return done;
+    }
+    thread_cache *cache = cache_get(pool);
+    bool flushed = false;
+    pool_lock(pool);
+    while (pool->backend == MEM_BACKEND_BUDDY && done < count) {
+        // Buddy blocks are only ever split, so there are no runs to carve
+        if (!(out_ptrs[done] = block_alloc_or_flush(pool, granules, pool->min_alignment, cache))) {
+            break;
+        }
+        done++;
+    }
+    while (pool->backend != MEM_BACKEND_BUDDY && done < count) {
+        // Try one run for everything that is left, halving it until a free block fits
+        size_t span = count - done;
+        if (span > pool->pool_granules / granules) {
+            span = pool->pool_granules / granules;
+        }
+        uint32_t index = MEM_NIL;
+        while (span > 0 && (index = free_list_find(pool, span * granules)) == MEM_NIL) {
+            span /= 2;
+        }
+        if (index == MEM_NIL) {
+            if (!cache || flushed) {
+                break;
+            }
+            cache_flush_all(cache);
+            flushed = true;
+            continue;
+        }
+        block_carve(pool, index, index, span * granules);
+        for (size_t i = 0; i < span; i++) {
+            block_set(pool, index + i * granules, granules, true);
+            out_ptrs[done++] = granule_ptr(pool, index + i * granules);
+        }
+    }
+    pool->counters.allocs += done;
+    if (done < count) {
+        pool->counters.failed_allocs++;
+    }
+    pool_unlock(pool);
+    for (size_t i = done; i < count; i++) {
+        out_ptrs[i] = NULL;
+    }
+    return done;
+}
+
+static int compare_ptrs(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(void *const *)a;
+    uintptr_t y = (uintptr_t)*(void *const *)b;
+    return (x > y) - (x < y);
+}
+
+// Batch deallocation function: frees count blocks under a single lock. The caller
+// passes the pointers in address order, so that runs of adjacent blocks are merged
+// and released as one; ptrs is not modified. NULL, foreign and duplicate pointers
+// are skipped.
+static void pool_free_batch(mem_pool_t *pool, void **ptrs, size_t count) {
+    if (pool->region) {
+        for (size_t i = 0; i < count; i++) {
+            region_free_counted(pool->region, ptrs[i]);
+        }
+        return;
+    }
+    pool_lock(pool);
+    uint32_t first = MEM_NIL;
+    uint32_t end = MEM_NIL;
+    for (size_t i = 0; i <= count; i++) {
+        uint32_t index = (i < count) ? granule_index(pool, ptrs[i]) : MEM_NIL;
+        if (index != MEM_NIL && !block_claim_start(pool, index)) {
+            continue; // Not a used block, or a duplicate
+        }
+        if (index != MEM_NIL) {
+            pool->counters.frees++;
+        }
+        if (index != MEM_NIL && index == end && pool->backend != MEM_BACKEND_BUDDY) {
+            end += tag_size(pool, index);
+            continue;
+        }
+        if (first != MEM_NIL) {
+            block_set(pool, first, end - first, true);
+            block_release(pool, first);
+        }
+        first = index;
+        end = (index != MEM_NIL) ? index + tag_size(pool, index) : MEM_NIL;
+    }
+    pool_unlock(pool);
+}
+
+// Deallocation function: parks small blocks in the thread cache, flushing half of a full bin
+static void cache_free(thread_cache *cache, uint32_t index) {
+    mem_pool_t *pool = cache->pool;
+    uint32_t granules = tag_size(pool, index);
+    if (granules > MEM_EXACT_CLASSES || (pool->block_tags[index] & TAG_EXT)) {
+        CACHE_COUNT(cache, free_misses);
+        pool_lock(pool);
+        block_release(pool, index);
+        pool->counters.frees++;
+        pool_unlock(pool);
+        return;
+    }
+    int class = granules - 1;
+    void *ptr = granule_ptr(pool, index);
+    *(void **)ptr = cache->bins[class];
+    cache->bins[class] = ptr;
+    cache->counts[class]++;
+    CACHE_COUNT(cache, free_hits);
+    if (cache->counts[class] > pool->cache_capacity) {
+        pool_lock(pool);
+        cache_flush_class(cache, class, cache->counts[class] / 2 + 1);
+        pool_unlock(pool);
+        CACHE_COUNT(cache, flushes);
+    }
+}
+
+// Deallocation function: marks a block as free and merges it with free neighbours
+static void pool_free(mem_pool_t *pool, void* block) {
+    if (pool->region) {
+        region_free_counted(pool->region, block);
+        return;
+    }
+    thread_cache *cache = cache_get(pool);
+    if (cache) {
+        // Claiming the start bit makes the block ours without taking the lock;
+        // freeing a foreign or already freed pointer finds the bit clear
+        uint32_t index = granule_index(pool, block);
+        if (index != MEM_NIL && block_claim_start(pool, index)) {
+            cache_free(cache, index);
+        }
+        return;
+    }
+    pool_lock(pool);
+    uint32_t index = block_find(pool, block);
+    if (index != MEM_NIL) {
+        block_release(pool, index);
+        pool->counters.frees++;
+    }
+    pool_unlock(pool);
+}
+
+// Resize function for region blocks: stays in place while the size class has room,
+// otherwise moves the block to one of the new class
+static void* region_resize(mem_region_t *region, void *block, size_t size) {
+    mem_pool_t *pool = region->pool;
+    uint32_t index = granule_index(pool, block);
+    if (index == MEM_NIL || index < region->base || index >= region->end || !region_is_start(region, index)) {
+        return NULL;
+    }
+    REGION_COUNT(region, resizes);
+    uint32_t old_granules = tag_size(pool, index);
+    if (size_to_granules(pool, size) <= old_granules) {
+        return block;
+    }
+    void *newblock = region_alloc(region, size_to_granules(pool, size), pool->min_alignment);
+    if (newblock) {
+        memcpy(newblock, block, (size_t)old_granules * MEM_GRANULE);
+        region_free(region, block);
+    }
+    return newblock;
+}
+
+// Resize function: changes the size of the memory block in place when the space after
+// it allows, otherwise moves it
+static void* pool_resize(mem_pool_t *pool, void* block, size_t size) {
+    if (size > pool->size_of_pool) {
+        return NULL; // Cannot resize to a size larger than the pool
+    }
+
+    if (!block) {
+        return pool_alloc(pool, size); // Allocate a new block
+    }
+
+    if (size == 0) {
+        pool_free(pool, block);
+        return NULL; // Free the block
+    }
+    if (pool->region) {
+        return region_resize(pool->region, block, size);
+    }
+    pool_lock(pool);
+
+    uint32_t index = block_find(pool, block);
+    if (index == MEM_NIL) {
+        pool_unlock(pool);
+        return NULL; // Block not found
+    }
+    pool->counters.resizes++;
+    size_t alignment = block_alignment(pool, index);
+    uint32_t granules = size_to_granules(pool, size);
+    if (alignment > pool->min_alignment && granules < 2) {
+        granules = 2;
+    }
+    uint32_t old_granules = tag_size(pool, index);
+    if (pool->backend == MEM_BACKEND_BUDDY) {
+        // A buddy block that moves only ever grows, which keeps its alignment
+        void *newblock = block;
+        if (buddy_resize(pool, index, granules)) {
+            if (tag_size(pool, index) > old_granules) {
+                pool->resize_stats.in_place_grows++;
+            } else {
+                pool->resize_stats.in_place_shrinks++;
+            }
+        } else if ((newblock = block_alloc(pool, granules, alignment))) {
+            memcpy(newblock, block, (size_t)old_granules * MEM_GRANULE);
+            block_release(pool, index);
+            pool->resize_stats.moves++;
+        } else {
+            pool->resize_stats.failures++;
+        }
+        pool_unlock(pool);
+        return newblock;
+    }
+    if (granules <= old_granules) {
+        if (granules < old_granules) {
+            block_truncate(pool, index, granules);
+            if (alignment > pool->min_alignment) {
+                block_set_alignment(pool, index, alignment);
+            }
+        }
+        pool->resize_stats.in_place_shrinks++;
+        pool_unlock(pool);
+        return block;
+    }
+    if (block_extend(pool, index, granules)) {
+        if (alignment > pool->min_alignment) {
+            block_set_alignment(pool, index, alignment);
+        }
+        pool->resize_stats.in_place_grows++;
+        pool_unlock(pool);
+        return block;
+    }
+
+    size_t copy_size = (size_t)old_granules * MEM_GRANULE;
+    void *newblock = block_alloc(pool, granules, alignment);
+    if (newblock) {
+        memcpy(newblock, block, copy_size);
+        block_release(pool, index);
+        pool->resize_stats.moves++;
+        pool_unlock(pool);
+        return newblock;
+    }
+
+    // No other block fits, but the block merged with its free neighbours might.
+    // The neighbours are unlinked before moving so their free-list links cannot
+    // overwrite the data.
+    uint32_t first = index;
+    uint32_t end = index + tag_size(pool, index);
+    if (index > 0 && !tag_used(pool, index - 1)) {
+        first = index - tag_size(pool, index - 1);
+    }
+    if (end < pool->pool_granules && !tag_used(pool, end)) {
+        end += tag_size(pool, end);
+    }
+    uint32_t start = first + align_padding(pool, first, alignment);
+    if (start > index || end - start < granules) {
+        pool->resize_stats.failures++;
+        pool_unlock(pool);
+        return NULL; // Allocation failed
+    }
+    if (first != index) {
+        free_list_remove(pool, first);
+        block_clear_start(pool, index);
+    }
+    if (end != index + tag_size(pool, index)) {
+        free_list_remove(pool, index + tag_size(pool, index));
+    }
+    newblock = granule_ptr(pool, start);
+    memmove(newblock, block, copy_size);
+    block_set(pool, start, granules, true);
+    if (alignment > pool->min_alignment) {
+        block_set_alignment(pool, start, alignment);
+    }
+    if (first < start) {
+        free_list_push(pool, first, start - first);
+    }
+    if (start + granules < end) {
+        free_list_push(pool, start + granules, end - start - granules);
+    }
+    free_map_mark(pool, first, end - first, true);
+    free_map_mark(pool, start, granules, false);
+    pool->resize_stats.moves++;
+    pool_unlock(pool);
+    return newblock;
+}
+
+// Ownership query: reports whether ptr is the start of a live block in the pool
+static bool pool_owns(mem_pool_t *pool, void* ptr) {
+    pool_lock(pool);
+    bool owned = block_find(pool, ptr) != MEM_NIL;
+    pool_unlock(pool);
+    return owned;
+}
+
+// Size query: returns the usable size of a live block, or 0 for foreign pointers
+static size_t pool_usable_size(mem_pool_t *pool, void* ptr) {
+    pool_lock(pool);
+    uint32_t index = block_find(pool, ptr);
+    size_t size = (index != MEM_NIL) ? (size_t)tag_size(pool, index) * MEM_GRANULE : 0;
+    pool_unlock(pool);
+    return size;
+}
+
+// Finds the chunk of a growable pool whose memory holds ptr, caller holds chain_lock
+static mem_pool_t *chain_owner(mem_pool_t *head, void *ptr) {
+    for (mem_pool_t *chunk = head; chunk != NULL; chunk = chunk->next_chunk) {
+        if ((char *)ptr >= (char *)chunk->memory_pool && (char *)ptr < (char *)chunk->memory_pool + (size_t)chunk->pool_granules * MEM_GRANULE) {
+            return chunk;
+        }
+    }
+    return NULL;
+}
+
+// Tries the chunks in order, so allocations settle in the oldest ones and the newest
+// are the first to drain, caller holds chain_lock
+static void *chain_try_alloc(mem_pool_t *head, size_t size, size_t alignment) {
+    for (mem_pool_t *chunk = head; chunk != NULL; chunk = chunk->next_chunk) {
+        void *ptr = pool_alloc_aligned(chunk, size, alignment);
+        if (ptr) {
+            return ptr;
+        }
+    }
+    return NULL;
+}
+
+// Appends a chunk growth_factor times the size of the last one, large enough for
+// the request and within max_size, caller holds chain_lock for writing
+static mem_pool_t *chain_grow(mem_pool_t *head, size_t size, size_t alignment) {
+    mem_pool_t *last = head;
+    while (last->next_chunk) {
+        last = last->next_chunk;
+    }
+    size_t needed = size + ((alignment > head->min_alignment) ? alignment : 0);
+    size_t chunk_size = last->size_of_pool * head->growth_factor;
+    if (chunk_size < needed) {
+        chunk_size = needed;
+    }
+    if (head->max_size) {
+        if (head->chain_size >= head->max_size) {
+            return NULL;
+        }
+        if (chunk_size > head->max_size - head->chain_size) {
+            chunk_size = head->max_size - head->chain_size;
+        }
+        if (chunk_size < needed) {
+            return NULL;
+        }
+    }
+    mem_pool_t *chunk = mem_pool_create_ex(chunk_size, &head->chunk_options);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk_set_cache_capacity(chunk, __atomic_load_n(&head->cache_capacity, __ATOMIC_RELAXED));
+    last->next_chunk = chunk;
+    head->chain_size += chunk_size;
+    return chunk;
+}
+
+static void *chain_alloc(mem_pool_t *head, size_t size, size_t alignment) {
+    pthread_rwlock_rdlock(&head->chain_lock);
+    void *ptr = chain_try_alloc(head, size, alignment);
+    pthread_rwlock_unlock(&head->chain_lock);
+    if (ptr) {
+        return ptr;
+    }
+    pthread_rwlock_wrlock(&head->chain_lock);
+    ptr = chain_try_alloc(head, size, alignment); // Another thread may have grown the chain
+    if (!ptr) {
+        mem_pool_t *chunk = chain_grow(head, size, alignment);
+        ptr = chunk ? pool_alloc_aligned(chunk, size, alignment) : NULL;
+    }
+    pthread_rwlock_unlock(&head->chain_lock);
+    return ptr;
+}
+
+static bool chunk_is_empty(mem_pool_t *chunk) {
+    pool_lock(chunk);
+    bool empty = chunk->counters.free_granules == chunk->pool_granules;
+    pool_unlock(chunk);
+    return empty;
+}
+
+// Unlinks and destroys a chunk other than the head once it is entirely free
+static void chain_release(mem_pool_t *head, mem_pool_t *chunk) {
+    pthread_rwlock_wrlock(&head->chain_lock);
+    mem_pool_t *prev = head;
+    while (prev->next_chunk && prev->next_chunk != chunk) {
+        prev = prev->next_chunk;
+    }
+    bool release = prev->next_chunk == chunk && chunk_is_empty(chunk);
+    if (release) {
+        prev->next_chunk = chunk->next_chunk;
+        chunk->next_chunk = NULL;
+        head->chain_size -= chunk->size_of_pool;
+    }
+    pthread_rwlock_unlock(&head->chain_lock);
+    if (release) {
+        mem_pool_destroy(chunk);
+    }
+}
+
+static void chain_free(mem_pool_t *head, void *block) {
+    pthread_rwlock_rdlock(&head->chain_lock);
+    mem_pool_t *chunk = chain_owner(head, block);
+    if (chunk) {
+        pool_free(chunk, block);
+    }
+    bool drained = chunk && chunk != head && chunk_is_empty(chunk);
+    pthread_rwlock_unlock(&head->chain_lock);
+    if (drained) {
+        chain_release(head, chunk);
+    }
+}
+
+// Resize function for growable pools: resizes within the block's chunk when possible,
+// otherwise moves the block to wherever the chain has room
+static void* chain_resize(mem_pool_t *head, void *block, size_t size) {
+    if (!block) {
+        return chain_alloc(head, size, head->min_alignment);
+    }
+    if (size == 0) {
+        chain_free(head, block);
+        return NULL;
+    }
+    pthread_rwlock_rdlock(&head->chain_lock);
+    mem_pool_t *chunk = chain_owner(head, block);
+    size_t old_size = chunk ? pool_usable_size(chunk, block) : 0;
+    void *newblock = (old_size && size <= chunk->size_of_pool) ? pool_resize(chunk, block, size) : NULL;
+    pthread_rwlock_unlock(&head->chain_lock);
+    if (newblock || old_size == 0) {
+        return newblock;
+    }
+    newblock = chain_alloc(head, size, head->min_alignment);
+    if (newblock) {
+        memcpy(newblock, block, (old_size < size) ? old_size : size);
+        chain_free(head, block);
+    }
+    return newblock;
+}
+
+// Shard of a sharded pool holding ptr, found by address arithmetic alone
+static mem_pool_t *shard_owner(mem_pool_t *head, void *ptr) {
+    if ((char *)ptr < (char *)head->memory_pool) {
+        return NULL;
+    }
+    size_t shard = ((char *)ptr - (char *)head->memory_pool) / head->shard_bytes;
+    return (shard < head->shard_count) ? head->shards[shard] : NULL;
+}
+
+// Home shard of the calling thread. Threads are numbered in order of first use, so
+// consecutive threads spread evenly over the shards.
+static uint32_t shard_home(mem_pool_t *head) {
+    static uint32_t threads_seen;
+    static __thread uint32_t thread_number;
+    if (thread_number == 0) {
+        thread_number = __atomic_add_fetch(&threads_seen, 1, __ATOMIC_RELAXED);
+    }
+    return (thread_number - 1) % head->shard_count;
+}
+
+// Tries the home shard first, then its neighbours in order
+static void *shard_alloc(mem_pool_t *head, size_t size, size_t alignment) {
+    uint32_t home = shard_home(head);
+    for (uint32_t i = 0; i < head->shard_count; i++) {
+        void *ptr = pool_alloc_aligned(head->shards[(home + i) % head->shard_count], size, alignment);
+        if (ptr) {
+            return ptr;
+        }
+    }
+    return NULL;
+}
+
+static void shard_free(mem_pool_t *head, void *block) {
+    mem_pool_t *shard = shard_owner(head, block);
+    if (shard) {
+        pool_free(shard, block);
+    }
 }
 
-memory_block *head;
-void *memory_pool;
-size_t size_of_pool;
+// Resize function for sharded pools: resizes within the block's shard when possible,
+// otherwise moves the block to whichever shard has room
+static void* shard_resize(mem_pool_t *head, void *block, size_t size) {
+    if (!block) {
+        return shard_alloc(head, size, head->min_alignment);
+    }
+    if (size == 0) {
+        shard_free(head, block);
+        return NULL;
+    }
+    mem_pool_t *shard = shard_owner(head, block);
+    size_t old_size = shard ? pool_usable_size(shard, block) : 0;
+    void *newblock = (old_size && size <= shard->size_of_pool) ? pool_resize(shard, block, size) : NULL;
+    if (newblock || old_size == 0) {
+        return newblock;
+    }
+    newblock = shard_alloc(head, size, head->min_alignment);
+    if (newblock) {
+        memcpy(newblock, block, (old_size < size) ? old_size : size);
+        pool_free(shard, block);
+    }
+    return newblock;
+}
 
-pthread_mutex_t memory_mutex;
+// The functions below route growable pools through their chain of chunks and sharded
+// pools to the shard of the calling thread or of the block
 
-// Initialization function: creates a memory pool of the given size
-void mem_init(size_t size) {
-    head = NULL;
-    memory_pool = malloc(size);
-    size_of_pool = size;
-    pthread_mutex_init(&memory_mutex, NULL);
+static void* route_alloc(mem_pool_t *pool, size_t size) {
+    if (pool->growable && size > 0) {
+        return chain_alloc(pool, size, pool->min_alignment);
+    }
+    if (pool->shard_count && size > 0) {
+        return shard_alloc(pool, size, pool->min_alignment);
+    }
+    return pool_alloc(pool, size);
 }
 
-// Allocation function: finds the first free block that fits the requested size
-void* mem_alloc(size_t size) {
-    if (size > size_of_pool) {
-        return NULL; // Cannot allocate more than the pool size
+static void* route_alloc_aligned(mem_pool_t *pool, size_t size, size_t alignment) {
+    if (pool->growable && (alignment & (alignment - 1)) == 0) {
+        return chain_alloc(pool, size ? size : 1, alignment);
     }
-    if (size == 0) {
-        return memory_pool; // Return the start of the memory pool
+    if (pool->shard_count && (alignment & (alignment - 1)) == 0) {
+        return shard_alloc(pool, size ? size : 1, alignment);
     }
-    pthread_mutex_lock(&memory_mutex);
+    return pool_alloc_aligned(pool, size, alignment);
+}
 
-    // Insertion first
-    if (head == NULL || head->start - memory_pool >= size) {
-        memory_block *new_block = memory_block_init(memory_pool, memory_pool + size, head);
-        head = new_block;
-        pthread_mutex_unlock(&memory_mutex);
-        return memory_pool;
+static size_t route_alloc_batch(mem_pool_t *pool, size_t size, size_t count, void **out_ptrs) {
+    if (pool->shard_count && size > 0) {
+        size_t done = 0;
+        uint32_t home = shard_home(pool);
+        for (uint32_t i = 0; i < pool->shard_count && done < count; i++) {
+            done += pool_alloc_batch(pool->shards[(home + i) % pool->shard_count], size, count - done, out_ptrs + done);
+        }
+        return done;
     }
+    if (!pool->growable || size == 0) {
+        return pool_alloc_batch(pool, size, count, out_ptrs);
+    }
+    size_t done = 0;
+    pthread_rwlock_rdlock(&pool->chain_lock);
+    for (mem_pool_t *chunk = pool; chunk != NULL && done < count; chunk = chunk->next_chunk) {
+        done += pool_alloc_batch(chunk, size, count - done, out_ptrs + done);
+    }
+    pthread_rwlock_unlock(&pool->chain_lock);
+    while (done < count && (out_ptrs[done] = chain_alloc(pool, size, pool->min_alignment))) {
+        done++;
+    }
+    return done;
+}
 
-    // Insertion between blocks or last
-    memory_block *walker = head;
-    while (walker != NULL) {
-        size_t space = (walker->next) ? walker->next->start - walker->end : memory_pool + size_of_pool - walker->end;
-        if (space >= size) {
-            memory_block *new_block = memory_block_init(walker->end, walker->end + size, walker->next);
-            walker->next = new_block;
-            void *return_ptr = walker->end;
-            pthread_mutex_unlock(&memory_mutex);
-            return return_ptr;
+// Frees pointers sorted by address, routing each run to the shard or chunk that owns it
+static void route_free_sorted(mem_pool_t *pool, void **ptrs, size_t count) {
+    if (pool->shard_count) {
+        // Sorted, the pointers of each shard form one run
+        for (size_t i = 0; i < count;) {
+            mem_pool_t *shard = shard_owner(pool, ptrs[i]);
+            size_t run = 1;
+            while (shard && i + run < count && shard_owner(pool, ptrs[i + run]) == shard) {
+                run++;
+            }
+            if (shard) {
+                pool_free_batch(shard, ptrs + i, run);
+            }
+            i += run;
         }
-        walker = walker->next;
+        return;
+    }
+    if (!pool->growable) {
+        pool_free_batch(pool, ptrs, count);
+        return;
+    }
+    // Sorted, the pointers of each chunk form one run
+    for (size_t i = 0; i < count;) {
+        pthread_rwlock_rdlock(&pool->chain_lock);
+        mem_pool_t *chunk = chain_owner(pool, ptrs[i]);
+        size_t run = 1;
+        while (chunk && i + run < count && chain_owner(pool, ptrs[i + run]) == chunk) {
+            run++;
+        }
+        if (chunk) {
+            pool_free_batch(chunk, ptrs + i, run);
+        }
+        bool drained = chunk && chunk != pool && chunk_is_empty(chunk);
+        pthread_rwlock_unlock(&pool->chain_lock);
+        if (drained) {
+            chain_release(pool, chunk);
+        }
+        i += run;
     }
-    pthread_mutex_unlock(&memory_mutex);
-    return NULL;
 }
 
-// Allocation function: finds the first free block that fits the requested size
-void* mem_alloc_without_locks(size_t size) {
-    if (size > size_of_pool) {
-        return NULL; // Cannot allocate more than the pool size
+static void route_free_batch(mem_pool_t *pool, void **ptrs, size_t count) {
+    void *sorted[FREE_BATCH_CHUNK];
+    for (size_t done = 0; done < count;) {
+        size_t n = (count - done < FREE_BATCH_CHUNK) ? count - done : FREE_BATCH_CHUNK;
+        memcpy(sorted, ptrs + done, n * sizeof(*ptrs));
+        qsort(sorted, n, sizeof(*sorted), compare_ptrs);
+        route_free_sorted(pool, sorted, n);
+        done += n;
     }
-    if (size == 0) {
-        return memory_pool; // Return the start of the memory pool
+}
+
+static void route_free(mem_pool_t *pool, void* block) {
+    if (pool->growable) {
+        chain_free(pool, block);
+    } else if (pool->shard_count) {
+        shard_free(pool, block);
+    } else {
+        pool_free(pool, block);
     }
+}
 
-    // Insertion first
-    if (head == NULL || head->start - memory_pool >= size) {
-        memory_block *new_block = memory_block_init(memory_pool, memory_pool + size, head);
-        head = new_block;
-        return memory_pool;
+static void* route_resize(mem_pool_t *pool, void* block, size_t size) {
+    if (pool->shard_count) {
+        return shard_resize(pool, block, size);
     }
+    return pool->growable ? chain_resize(pool, block, size) : pool_resize(pool, block, size);
+}
 
-    // Insertion between blocks or last
-    memory_block *walker = head;
-    while (walker != NULL) {
-        size_t space = (walker->next) ? walker->next->start - walker->end : memory_pool + size_of_pool - walker->end;
-        if (space >= size) {
-            memory_block *new_block = memory_block_init(walker->end, walker->end + size, walker->next);
-            walker->next = new_block;
-            void *return_ptr = walker->end;
-            return return_ptr;
-        }
-        walker = walker->next;
+// The public entry points below add the hooks of the sampling profiler and the
+// tracer, which cost a single load each while the pool has never used them
+
+static inline mem_profiler_t *pool_profiler(mem_pool_t *pool) {
+    return __atomic_load_n(&pool->profiler, __ATOMIC_ACQUIRE);
+}
+
+static inline mem_tracer_t *pool_tracer(mem_pool_t *pool) {
+    return __atomic_load_n(&pool->tracer, __ATOMIC_ACQUIRE);
+}
+
+void* mem_pool_alloc(mem_pool_t *pool, size_t size) {
+    void *ptr = route_alloc(pool, size);
+    mem_profiler_t *profiler = pool_profiler(pool);
+    if (profiler && ptr && size > 0) {
+        mem_profiler_alloc(profiler, ptr, size);
     }
-    return NULL;
+    mem_tracer_t *tracer = pool_tracer(pool);
+    if (tracer) {
+        mem_tracer_alloc(tracer, ptr, size, 0);
+    }
+    return ptr;
 }
 
-// Deallocation function: marks a block as free
-void mem_free(void* block) {
-    pthread_mutex_lock(&memory_mutex);
-    if (!head) {
-        pthread_mutex_unlock(&memory_mutex);
-        return;
+void* mem_pool_alloc_aligned(mem_pool_t *pool, size_t size, size_t alignment) {
+    void *ptr = route_alloc_aligned(pool, size, alignment);
+    mem_profiler_t *profiler = pool_profiler(pool);
+    if (profiler && ptr && size > 0) {
+        mem_profiler_alloc(profiler, ptr, size);
     }
-    
-    if (head->start == block) { 
-        memory_block *temp = head;
-        head = head->next;
-        free(temp);
-        pthread_mutex_unlock(&memory_mutex);
+    mem_tracer_t *tracer = pool_tracer(pool);
+    if (tracer) {
+        mem_tracer_alloc(tracer, ptr, size, alignment);
+    }
+    return ptr;
+}
+
+size_t mem_pool_alloc_batch(mem_pool_t *pool, size_t size, size_t count, void **out_ptrs) {
+    size_t done = route_alloc_batch(pool, size, count, out_ptrs);
+    mem_profiler_t *profiler = pool_profiler(pool);
+    for (size_t i = 0; profiler && size > 0 && i < done; i++) {
+        mem_profiler_alloc(profiler, out_ptrs[i], size);
+    }
+    mem_tracer_t *tracer = pool_tracer(pool);
+    for (size_t i = 0; tracer && i < done; i++) {
+        mem_tracer_alloc(tracer, out_ptrs[i], size, 0);
+    }
+    return done;
+}
+
+void mem_pool_free_batch(mem_pool_t *pool, void **ptrs, size_t count) {
+    mem_profiler_t *profiler = pool_profiler(pool);
+    for (size_t i = 0; profiler && i < count; i++) {
+        mem_profiler_free(profiler, ptrs[i]);
+    }
+    mem_tracer_t *tracer = pool_tracer(pool);
+    for (size_t i = 0; tracer && i < count; i++) {
+        mem_tracer_free(tracer, ptrs[i]);
+    }
+    route_free_batch(pool, ptrs, count);
+}
+
+void mem_pool_free(mem_pool_t *pool, void* block) {
+    mem_profiler_t *profiler = pool_profiler(pool);
+    if (profiler) {
+        mem_profiler_free(profiler, block);
+    }
+    mem_tracer_t *tracer = pool_tracer(pool);
+    if (tracer) {
+        mem_tracer_free(tracer, block);
+    }
+    route_free(pool, block);
+}
+
+void* mem_pool_resize(mem_pool_t *pool, void* block, size_t size) {
+    mem_tracer_t *tracer = pool_tracer(pool);
+    uint32_t id = tracer ? mem_tracer_resize_begin(tracer, block) : 0;
+    void *newblock = route_resize(pool, block, size);
+    if (tracer) {
+        mem_tracer_resize_end(tracer, id, block, newblock, size);
+    }
+    mem_profiler_t *profiler = pool_profiler(pool);
+    if (profiler && newblock) {
+        mem_profiler_resize(profiler, block, newblock, size);
+    } else if (profiler && size == 0) {
+        mem_profiler_free(profiler, block);
+    }
+    return newblock;
+}
+
+// Profiling: samples about one allocation per sample_bytes bytes allocated, with its
+// backtrace, until the block is freed; 0 stops sampling new allocations
+void mem_pool_profile_set_rate(mem_pool_t *pool, size_t sample_bytes) {
+    mem_profiler_t *profiler = pool_profiler(pool);
+    if (!profiler && sample_bytes == 0) {
         return;
     }
-    
-    memory_block *walker = head;
-    while (walker->next != NULL) {
-        if (walker->next->start == block) {
-            memory_block *temp = walker->next;
-            walker->next = temp->next;
-            free(temp);
-            pthread_mutex_unlock(&memory_mutex);
+    if (!profiler) {
+        mem_profiler_t *created = mem_profiler_create();
+        if (!created) {
             return;
         }
-        walker = walker->next;
+        if (!__atomic_compare_exchange_n(&pool->profiler, &profiler, created, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            mem_profiler_destroy(created); // Another thread got there first
+        } else {
+            profiler = created;
+        }
     }
-    pthread_mutex_unlock(&memory_mutex);
-    return;
+    mem_profiler_set_rate(profiler, sample_bytes);
 }
 
-// Resize function: changes the size of the memory block, possibly moving it
-void* mem_resize(void* block, size_t size) {
-    if (size > size_of_pool) {
-        return NULL; // Cannot resize to a size larger than the pool
+// Profile dump: writes the live samples to fd as a heap profile pprof can read.
+// Returns 0 on success, -1 on a write error or if the pool was never profiled.
+int mem_pool_profile_dump(mem_pool_t *pool, int fd) {
+    mem_profiler_t *profiler = pool_profiler(pool);
+    return profiler ? mem_profiler_dump(profiler, fd) : -1;
+}
+
+// Tracing: records every allocation, free and resize to fd for mem_replay until
+// mem_pool_trace_stop. Returns 0 on success, -1 if the pool is already being traced
+// or the trace header cannot be written.
+int mem_pool_trace_start(mem_pool_t *pool, int fd) {
+    mem_tracer_t *tracer = pool_tracer(pool);
+    if (!tracer) {
+        mem_tracer_t *created = mem_tracer_create();
+        if (!created) {
+            return -1;
+        }
+        if (!__atomic_compare_exchange_n(&pool->tracer, &tracer, created, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            mem_tracer_destroy(created); // Another thread got there first
+        } else {
+            tracer = created;
+        }
     }
+    return mem_tracer_start(tracer, fd);
+}
 
-    if (!block) {
-        return mem_alloc(size); // Allocate a new block
+// Writes out the rest of the trace and stops recording; fd stays open. Returns 0 on
+// success, -1 if the pool was not being traced or a write failed.
+int mem_pool_trace_stop(mem_pool_t *pool) {
+    mem_tracer_t *tracer = pool_tracer(pool);
+    return tracer ? mem_tracer_stop(tracer) : -1;
+}
+
+bool mem_pool_owns(mem_pool_t *pool, void* ptr) {
+    if (pool->shard_count) {
+        mem_pool_t *shard = shard_owner(pool, ptr);
+        return shard && pool_owns(shard, ptr);
+    }
+    if (!pool->growable) {
+        return pool_owns(pool, ptr);
+    }
+    pthread_rwlock_rdlock(&pool->chain_lock);
+    mem_pool_t *chunk = chain_owner(pool, ptr);
+    bool owned = chunk && pool_owns(chunk, ptr);
+    pthread_rwlock_unlock(&pool->chain_lock);
+    return owned;
+}
+
+size_t mem_pool_usable_size(mem_pool_t *pool, void* ptr) {
+    if (pool->shard_count) {
+        mem_pool_t *shard = shard_owner(pool, ptr);
+        return shard ? pool_usable_size(shard, ptr) : 0;
+    }
+    if (!pool->growable) {
+        return pool_usable_size(pool, ptr);
+    }
+    pthread_rwlock_rdlock(&pool->chain_lock);
+    mem_pool_t *chunk = chain_owner(pool, ptr);
+    size_t size = chunk ? pool_usable_size(chunk, ptr) : 0;
+    pthread_rwlock_unlock(&pool->chain_lock);
+    return size;
+}
+
+// Thread cache switch: lets each thread keep up to capacity freed blocks per small
+// size class, 0 disables caching for blocks freed from now on. Other threads' caches
+// are only touched by their own thread, so their blocks go back when it exits.
+// Returns false if caching could not be turned on, for want of a pthread key.
+bool mem_pool_set_thread_cache(mem_pool_t *pool, size_t capacity) {
+    if (capacity > CACHE_MAX_CAPACITY) {
+        capacity = CACHE_MAX_CAPACITY;
+    }
+    if (pool->growable) {
+        pthread_rwlock_rdlock(&pool->chain_lock);
+    }
+    bool enabled = true;
+    for (mem_pool_t *chunk = pool; chunk != NULL; chunk = chunk->next_chunk) {
+        enabled = chunk_set_cache_capacity(chunk, capacity) && enabled;
+    }
+    if (pool->growable) {
+        pthread_rwlock_unlock(&pool->chain_lock);
+    }
+    return enabled;
+}
+
+// Cache statistics: sums the counters of all live and exited thread caches
+static void chunk_cache_stats(mem_pool_t *pool, struct mem_cache_stats *stats) {
+    pool_lock(pool);
+    cache_stats_add(stats, &pool->retired_cache_stats);
+    for (thread_cache *cache = pool->caches; cache != NULL; cache = cache->next) {
+        cache_stats_add(stats, &cache->stats);
+    }
+    pool_unlock(pool);
+}
+
+void mem_pool_cache_stats(mem_pool_t *pool, struct mem_cache_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (pool->growable) {
+        pthread_rwlock_rdlock(&pool->chain_lock);
+    }
+    for (mem_pool_t *chunk = pool; chunk != NULL; chunk = chunk->next_chunk) {
+        chunk_cache_stats(chunk, stats);
+    }
+    if (pool->growable) {
+        pthread_rwlock_unlock(&pool->chain_lock);
+    }
+}
+
+// Resize statistics: how often mem_pool_resize stayed in place or had to move
+void mem_pool_resize_stats(mem_pool_t *pool, struct mem_resize_stats *stats) {
+    pool_lock(pool);
+    *stats = pool->resize_stats;
+    pool_unlock(pool);
+    // Chunks and shards only see resizes that stay within them; moves between them are not counted
+    if (pool->growable) {
+        pthread_rwlock_rdlock(&pool->chain_lock);
+    }
+    for (mem_pool_t *chunk = pool->next_chunk; chunk != NULL; chunk = chunk->next_chunk) {
+        pool_lock(chunk);
+        stats->in_place_grows += chunk->resize_stats.in_place_grows;
+        stats->in_place_shrinks += chunk->resize_stats.in_place_shrinks;
+        stats->moves += chunk->resize_stats.moves;
+        stats->failures += chunk->resize_stats.failures;
+        pool_unlock(chunk);
+    }
+    if (pool->growable) {
+        pthread_rwlock_unlock(&pool->chain_lock);
+    }
+}
+
+// Largest free block in granules: every block of an exact class or buddy order has the
+// same size, otherwise only the list of the highest non-empty class needs scanning.
+// Bitmap pools rescan their map only once a run of the longest length was taken.
+static uint32_t largest_free_block(mem_pool_t *pool) {
+    if (pool->backend == MEM_BACKEND_BITMAP) {
+        if (pool->longest_run == MEM_NIL) {
+            pool->longest_run = mem_bitmap_longest_run(pool->free_map, (pool->pool_granules + 63) / 64);
+        }
+        return pool->longest_run;
+    }
+    if (pool->placement == MEM_PLACEMENT_BEST_FIT) {
+        uint32_t node = pool->free_tree;
+        while (node != MEM_NIL && tree_at(pool, node)->right != MEM_NIL) {
+            node = tree_at(pool, node)->right;
+        }
+        return (node != MEM_NIL) ? tag_size(pool, node) : 0;
+    }
+    if (!pool->free_classes) {
+        return 0;
+    }
+    int class = 63 - __builtin_clzll(pool->free_classes);
+    uint32_t largest = 0;
+    for (uint32_t walker = pool->free_lists[class]; walker != MEM_NIL; walker = free_node(pool, walker)->next) {
+        if (tag_size(pool, walker) > largest) {
+            largest = tag_size(pool, walker);
+        }
+        if (class < MEM_EXACT_CLASSES || pool->backend == MEM_BACKEND_BUDDY) {
+            break;
+        }
+    }
+    return largest;
+}
+
+// Adds one chunk's counters, with thread-cache and region traffic folded in, and its
+// lock statistics to the totals
+static void chunk_counters_add(mem_pool_t *pool, struct pool_counters *total, struct mem_lock_stats *total_locking, size_t *largest) {
+    struct mem_cache_stats cached = {0};
+    chunk_cache_stats(pool, &cached);
+    pool_lock(pool);
+    struct pool_counters counters = pool->counters;
+    struct mem_lock_stats locking = pool->memory_lock.stats;
+    size_t chunk_largest = largest_free_block(pool);
+    pool_unlock(pool);
+    counters.allocs += cached.alloc_hits;
+    counters.frees += cached.free_hits;
+
+    if (pool->region) {
+        mem_region_t *region = pool->region;
+        uint64_t top = __atomic_load_n(&region->top, __ATOMIC_RELAXED);
+        counters.free_granules = (top < region->end) ? region->end - top : 0;
+        counters.free_blocks = counters.free_granules ? 1 : 0;
+        chunk_largest = counters.free_granules;
+        counters.allocs += __atomic_load_n(&region->counters.allocs, __ATOMIC_RELAXED);
+        counters.frees += __atomic_load_n(&region->counters.frees, __ATOMIC_RELAXED);
+        counters.resizes += __atomic_load_n(&region->counters.resizes, __ATOMIC_RELAXED);
+        counters.failed_allocs += __atomic_load_n(&region->counters.failed_allocs, __ATOMIC_RELAXED);
+    }
+    if (chunk_largest > *largest) {
+        *largest = chunk_largest;
+    }
+    total->allocs += counters.allocs;
+    total->frees += counters.frees;
+    total->resizes += counters.resizes;
+    total->failed_allocs += counters.failed_allocs;
+    total->searches += counters.searches;
+    total->search_steps += counters.search_steps;
+    total->free_granules += counters.free_granules;
+    total->free_blocks += counters.free_blocks;
+    total_locking->acquires += locking.acquires;
+    total_locking->contentions += locking.contentions;
+    total_locking->wait_ns += locking.wait_ns;
+}
+
+// Statistics: a snapshot of space use, operation counts and lock contention. It costs
+// one short critical section per chunk, cheap enough to poll from a metrics thread.
+void mem_pool_stats(mem_pool_t *pool, struct mem_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    struct pool_counters counters = {0};
+    struct mem_lock_stats locking = {0};
+    size_t largest = 0;
+    if (pool->growable) {
+        pthread_rwlock_rdlock(&pool->chain_lock);
+    }
+    for (mem_pool_t *chunk = pool; chunk != NULL; chunk = chunk->next_chunk) {
+        chunk_counters_add(chunk, &counters, &locking, &largest);
+        stats->pool_bytes += (size_t)chunk->pool_granules * MEM_GRANULE;
+        stats->chunks++;
+    }
+    if (pool->growable) {
+        pthread_rwlock_unlock(&pool->chain_lock);
     }
+    stats->backing = pool->backing;
+    stats->huge_pages = pool->huge_pages;
+    stats->free_bytes = counters.free_granules * MEM_GRANULE;
+    stats->used_bytes = stats->pool_bytes - stats->free_bytes;
+    stats->free_blocks = counters.free_blocks;
+    stats->largest_free = largest * MEM_GRANULE;
+    stats->fragmentation = stats->free_bytes ? 1.0 - (double)stats->largest_free / stats->free_bytes : 0.0;
+    stats->allocs = counters.allocs;
+    stats->frees = counters.frees;
+    stats->used_blocks = stats->allocs - stats->frees;
+    stats->resizes = counters.resizes;
+    stats->failed_allocs = counters.failed_allocs;
+    stats->avg_search_length = counters.searches ? (double)counters.search_steps / counters.searches : 0.0;
+    stats->lock_acquires = locking.acquires;
+    stats->lock_contentions = locking.contentions;
+    stats->lock_wait_ns = locking.wait_ns;
+}
+
+// Region creation function: carves a region of the given size out of the pool for
+// lock-free allocations that are freed with mem_region_free or all at once
+mem_region_t *mem_pool_region_create(mem_pool_t *pool, size_t size) {
+    if (size == 0 || size > pool->size_of_pool) {
+        return NULL;
+    }
+    uint32_t granules = size_to_granules(pool, size);
+    uint32_t header = pool->min_alignment / MEM_GRANULE;
+    thread_cache *cache = cache_get(pool);
+    pool_lock(pool);
+    void *ptr = pool->region ? NULL : block_alloc_or_flush(pool, header + granules, pool->min_alignment, cache);
+    count_alloc(pool, ptr);
+    pool_unlock(pool);
+    if (!ptr) {
+        return NULL;
+    }
+    uint32_t base = granule_index(pool, ptr) + header;
+    granules = tag_size(pool, base - header) - header; // Buddy blocks may be larger than asked
+    mem_region_t *region = region_new(pool, base, base + granules, NULL);
+    if (!region) {
+        pool_free(pool, ptr);
+        return NULL;
+    }
+    block_clear_start(pool, base - header); // The block is only freed through the region
+    return region;
+}
 
+void* mem_region_alloc(mem_region_t *region, size_t size) {
     if (size == 0) {
-        mem_free(block);
-        return NULL; // Free the block
+        return NULL;
+    }
+    return region_alloc(region, size_to_granules(region->pool, size), region->pool->min_alignment);
+}
+
+void mem_region_free(mem_region_t *region, void* ptr) {
+    region_free(region, ptr);
+}
+
+// Reset function: frees every allocation of the region at once; no thread may be
+// using the region meanwhile
+void mem_region_reset(mem_region_t *region) {
+    region_clear(region);
+}
+
+// Region destruction function: gives the region's block back to the pool
+void mem_region_destroy(mem_region_t *region) {
+    mem_pool_t *pool = region->pool;
+    region_clear(region);
+    uint32_t block = region->base - pool->min_alignment / MEM_GRANULE;
+    pool_lock(pool);
+    block_set(pool, block, region->end - block, true);
+    block_release(pool, block);
+    pool->counters.frees++;
+    pool_unlock(pool);
+    free(region);
+}
+
+// Handle header: the granules ahead of a handle block's data, the first holding the handle
+static uint32_t handle_header(mem_pool_t *pool) {
+    return pool->min_alignment / MEM_GRANULE;
+}
+
+static handle_slot *handle_get(mem_pool_t *pool, mem_handle_t handle) {
+    if (handle == MEM_HANDLE_NONE || handle > pool->handle_count || pool->handles[handle - 1].pins == HANDLE_FREE) {
+        return NULL;
     }
-    pthread_mutex_lock(&memory_mutex);
+    return &pool->handles[handle - 1];
+}
 
-    // Find the block to resize
-    memory_block *before_node = NULL;
-    memory_block *node = head;
-    while (node != NULL && node->start != block) {
-        before_node = node;
-        node = node->next;
+// Handle allocation function: allocates a block that is reached through the returned
+// handle and may be moved by the compactor while unpinned. Growable pools allocate
+// handles from their first chunk and lock-free pools have none.
+mem_handle_t mem_pool_handle_alloc(mem_pool_t *pool, size_t size) {
+    if (size == 0 || size > pool->size_of_pool || pool->region) {
+        return MEM_HANDLE_NONE;
+    }
+    uint32_t header = handle_header(pool);
+    thread_cache *cache = cache_get(pool);
+    pool_lock(pool);
+    if (pool->free_handles == MEM_NIL && pool->handle_count == pool->handle_capacity) {
+        uint32_t capacity = pool->handle_capacity ? pool->handle_capacity * 2 : 64;
+        handle_slot *handles = realloc(pool->handles, capacity * sizeof(*handles));
+        if (!handles) {
+            pool_unlock(pool);
+            return MEM_HANDLE_NONE;
+        }
+        pool->handles = handles;
+        pool->handle_capacity = capacity;
+    }
+    void *ptr = block_alloc_or_flush(pool, header + size_to_granules(pool, size), pool->min_alignment, cache);
+    count_alloc(pool, ptr);
+    if (!ptr) {
+        pool_unlock(pool);
+        return MEM_HANDLE_NONE;
     }
+    uint32_t slot = pool->free_handles;
+    if (slot != MEM_NIL) {
+        pool->free_handles = pool->handles[slot].index;
+    } else {
+        slot = pool->handle_count++;
+    }
+    pool->handles[slot].index = granule_index(pool, ptr);
+    pool->handles[slot].pins = 0;
+    *(mem_handle_t *)ptr = slot + 1;
+    pool_unlock(pool);
+    return slot + 1;
+}
 
-    if (!node) {
-        pthread_mutex_unlock(&memory_mutex);
-        return NULL; // Block not found
+mem_handle_t mem_handle_alloc(size_t size) {
+    return default_pool ? mem_pool_handle_alloc(default_pool, size) : MEM_HANDLE_NONE;
+}
+
+// Handle deallocation function: frees the block, pinned or not, and retires the handle
+void mem_pool_handle_free(mem_pool_t *pool, mem_handle_t handle) {
+    pool_lock(pool);
+    handle_slot *slot = handle_get(pool, handle);
+    if (slot) {
+        block_release(pool, slot->index);
+        pool->counters.frees++;
+        slot->pins = HANDLE_FREE;
+        slot->index = pool->free_handles;
+        pool->free_handles = handle - 1;
     }
+    pool_unlock(pool);
+}
 
-    if (before_node) {
-        before_node->next = node->next;
+void mem_handle_free(mem_handle_t handle) {
+    if (default_pool) {
+        mem_pool_handle_free(default_pool, handle);
     }
-    else {
-        head = head->next;
+}
+
+// Pin function: returns the block's current address, which stays valid until the
+// matching unpin. Pins nest.
+void* mem_pool_handle_pin(mem_pool_t *pool, mem_handle_t handle) {
+    pool_lock(pool);
+    handle_slot *slot = handle_get(pool, handle);
+    void *ptr = NULL;
+    if (slot) {
+        slot->pins++;
+        ptr = granule_ptr(pool, slot->index + handle_header(pool));
     }
+    pool_unlock(pool);
+    return ptr;
+}
+
+void* mem_handle_pin(mem_handle_t handle) {
+    return default_pool ? mem_pool_handle_pin(default_pool, handle) : NULL;
+}
 
-    void *newblock = mem_alloc_without_locks(size); // Allocate a new block with the new size
+void mem_pool_handle_unpin(mem_pool_t *pool, mem_handle_t handle) {
+    pool_lock(pool);
+    handle_slot *slot = handle_get(pool, handle);
+    if (slot && slot->pins > 0) {
+        slot->pins--;
+    }
+    pool_unlock(pool);
+}
 
-    if (!newblock) {
-        if (before_node)
-            before_node->next = node;
-        else
-            head = node;
-        pthread_mutex_unlock(&memory_mutex);
-        return NULL; // Allocation failed
+void mem_handle_unpin(mem_handle_t handle) {
+    if (default_pool) {
+        mem_pool_handle_unpin(default_pool, handle);
     }
+}
 
-    // Copy the data from the old block to the new block and free the old block
-    size_t old_size = node->end - node->start;
-    free(node);
-    memcpy(newblock, block, (old_size < size) ? old_size : size);
-    pthread_mutex_unlock(&memory_mutex);
-    return newblock;
+// The handle slot of an unpinned handle block at index, or NULL if it cannot move.
+// Any other used block fails the check, as no live slot points at it.
+static handle_slot *handle_movable(mem_pool_t *pool, uint32_t index) {
+    if (!tag_used(pool, index) || (pool->block_tags[index] & TAG_EXT)) {
+        return NULL;
+    }
+    mem_handle_t handle = *(mem_handle_t *)granule_ptr(pool, index);
+    handle_slot *slot = handle_get(pool, handle);
+    return (slot && slot->index == index && slot->pins == 0) ? slot : NULL;
 }
 
-// Deinit function: frees the memory pool and resets state
-void mem_deinit() {
-    memory_block *walker = head;
-    while (walker != NULL) {
-        memory_block *temp = walker;
-        walker = walker->next;
+// Slides the handle block after the free block at index down to index, leaving the
+// free space after it, merged with any free block that follows
+static void handle_slide(mem_pool_t *pool, uint32_t index, handle_slot *slot) {
+    uint32_t gap = tag_size(pool, index);
+    uint32_t granules = tag_size(pool, slot->index);
+    free_list_remove(pool, index);
+    block_clear_start(pool, slot->index);
+    memmove(granule_ptr(pool, index), granule_ptr(pool, slot->index), (size_t)granules * MEM_GRANULE);
+    block_set(pool, index, granules, true);
+    free_map_mark(pool, index, gap, false);
+    block_set(pool, index + granules, gap, true);
+    block_release(pool, index + granules);
+    slot->index = index;
+}
+
+// Compaction step: slides unpinned handle blocks towards the start of the pool, so
+// free space gathers into large extents, for about budget_ns nanoseconds. Each call
+// resumes where the last one stopped and does at least one step. Returns false once
+// a full pass has moved nothing, true while there may be work left. Buddy pools do
+// not compact.
+bool mem_pool_compact(mem_pool_t *pool, uint64_t budget_ns) {
+    if (pool->backend == MEM_BACKEND_BUDDY || pool->region) {
+        return false;
+    }
+    uint64_t deadline = now_ns() + budget_ns;
+    pool_lock(pool);
+    uint32_t index = pool->compact_cursor;
+    bool more = true;
+    do {
+        if (index >= pool->pool_granules) {
+            more = pool->compact_moved;
+            pool->compact_moved = false;
+            index = 0;
+            break;
+        }
+        uint32_t next = index + tag_size(pool, index);
+        handle_slot *slot = NULL;
+        if (!tag_used(pool, index) && next < pool->pool_granules) {
+            slot = handle_movable(pool, next);
+        }
+        if (slot) {
+            handle_slide(pool, index, slot);
+            pool->compact_moved = true;
+        } else {
+            index = next;
+        }
+    } while (now_ns() < deadline);
+    pool->compact_cursor = index;
+    pool_unlock(pool);
+    return more;
+}
+
+bool mem_compact(uint64_t budget_ns) {
+    return default_pool ? mem_pool_compact(default_pool, budget_ns) : false;
+}
+
+// Fork support: takes every lock of the pool and its chunks or shards, so that a
+// child forked meanwhile cannot inherit a mutex held by another thread
+void mem_pool_lock_all(mem_pool_t *pool) {
+    if (pool->growable) {
+        pthread_rwlock_wrlock(&pool->chain_lock);
+    }
+    for (mem_pool_t *chunk = pool; chunk != NULL; chunk = chunk->next_chunk) {
+        pool_lock(chunk);
+    }
+}
+
+void mem_pool_unlock_all(mem_pool_t *pool) {
+    for (mem_pool_t *chunk = pool; chunk != NULL; chunk = chunk->next_chunk) {
+        pool_unlock(chunk);
+    }
+    if (pool->growable) {
+        pthread_rwlock_unlock(&pool->chain_lock);
+    }
+}
+
+// Destruction function: frees the pool and the thread caches that still refer to it
+void mem_pool_destroy(mem_pool_t *pool) {
+    while (pool->next_chunk) {
+        mem_pool_t *chunk = pool->next_chunk;
+        pool->next_chunk = chunk->next_chunk;
+        chunk->next_chunk = NULL;
+        mem_pool_destroy(chunk);
+    }
+    if (pool->growable) {
+        pthread_rwlock_destroy(&pool->chain_lock);
+    }
+    free(pool->shards);
+    if (pool->profiler) {
+        mem_profiler_destroy(pool->profiler);
+    }
+    if (pool->tracer) {
+        mem_tracer_destroy(pool->tracer);
+    }
+    if (pool->has_cache_key) {
+        pthread_key_delete(pool->cache_key);
+    }
+    while (pool->caches != NULL) {
+        thread_cache *temp = pool->caches;
+        pool->caches = pool->caches->next;
         free(temp);
     }
-    free(memory_pool);
-    size_of_pool = 0;
-    head = NULL;
-    pthread_mutex_destroy(&memory_mutex);
-}
\ No newline at end of file
+    mem_lock_deinit(&pool->memory_lock);
+    free(pool->region);
+    free(pool->handles);
+    free(pool->run_bounds);
+    if (pool->file_header) {
+        pool->file_header->clean = 1;
+    }
+    pool_unmap(pool);
+    free(pool);
+}
+
+// Initialization function: creates the default memory pool of the given size,
+// replacing any previous one
+void mem_init(size_t size) {
+    mem_init_ex(size, NULL);
+}
+
+// Initialization function: makes the pool persisted in the file at path the default
+// pool, see mem_pool_open_file. Returns false if the file cannot be used.
+bool mem_init_file(const char *path, size_t size) {
+    if (default_pool) {
+        mem_pool_destroy(default_pool);
+    }
+    default_pool = mem_pool_open_file(path, size, NULL);
+    return default_pool != NULL;
+}
+
+mem_pool_t *mem_default_pool() {
+    return default_pool;
+}
+
+// Initialization function: as mem_init, with pool options such as the minimum alignment
+void mem_init_ex(size_t size, const struct mem_pool_options *options) {
+    if (default_pool) {
+        mem_pool_destroy(default_pool);
+    }
+    default_pool = mem_pool_create_ex(size, options);
+}
+
+void* mem_alloc(size_t size) {
+    return default_pool ? mem_pool_alloc(default_pool, size) : NULL;
+}
+
+void* mem_alloc_aligned(size_t size, size_t alignment) {
+    return default_pool ? mem_pool_alloc_aligned(default_pool, size, alignment) : NULL;
+}
+
+size_t mem_alloc_batch(size_t size, size_t count, void **out_ptrs) {
+    if (!default_pool) {
+        for (size_t i = 0; i < count; i++) {
+            out_ptrs[i] = NULL;
+        }
+        return 0;
+    }
+    return mem_pool_alloc_batch(default_pool, size, count, out_ptrs);
+}
+
+void mem_free_batch(void **ptrs, size_t count) {
+    if (default_pool) {
+        mem_pool_free_batch(default_pool, ptrs, count);
+    }
+}
+
+mem_region_t *mem_region_create(size_t size) {
+    return default_pool ? mem_pool_region_create(default_pool, size) : NULL;
+}
+
+void mem_stats(struct mem_stats *stats) {
+    if (default_pool) {
+        mem_pool_stats(default_pool, stats);
+    } else {
+        memset(stats, 0, sizeof(*stats));
+    }
+}
+
+void mem_set_root(void *root) {
+    if (default_pool) {
+        mem_pool_set_root(default_pool, root);
+    }
+}
+
+void* mem_get_root() {
+    return default_pool ? mem_pool_get_root(default_pool) : NULL;
+}
+
+size_t mem_offset(void *ptr) {
+    return default_pool ? mem_pool_offset(default_pool, ptr) : 0;
+}
+
+void* mem_pointer(size_t offset) {
+    return default_pool ? mem_pool_pointer(default_pool, offset) : NULL;
+}
+
+int mem_checkpoint() {
+    return default_pool ? mem_pool_checkpoint(default_pool) : -1;
+}
+
+void mem_profile_set_rate(size_t sample_bytes) {
+    if (default_pool) {
+        mem_pool_profile_set_rate(default_pool, sample_bytes);
+    }
+}
+
+int mem_profile_dump(int fd) {
+    return default_pool ? mem_pool_profile_dump(default_pool, fd) : -1;
+}
+
+int mem_trace_start(int fd) {
+    return default_pool ? mem_pool_trace_start(default_pool, fd) : -1;
+}
+
+int mem_trace_stop() {
+    return default_pool ? mem_pool_trace_stop(default_pool) : -1;
+}
+
+void mem_free(void* block) {
+    if (default_pool) {
+        mem_pool_free(default_pool, block);
+    }
+}
+
+void* mem_resize(void* block, size_t size) {
+    return default_pool ? mem_pool_resize(default_pool, block, size) : NULL;
+}
+
+bool mem_owns(void* ptr) {
+    return default_pool ? mem_pool_owns(default_pool, ptr) : false;
+}
+
+size_t mem_usable_size(void* ptr) {
+    return default_pool ? mem_pool_usable_size(default_pool, ptr) : 0;
+}
+
+bool mem_set_thread_cache(size_t capacity) {
+    return default_pool ? mem_pool_set_thread_cache(default_pool, capacity) : false;
+}
+
+void mem_cache_stats(struct mem_cache_stats *stats) {
+    if (default_pool) {
+        mem_pool_cache_stats(default_pool, stats);
+    } else {
+        memset(stats, 0, sizeof(*stats));
+    }
+}
+
+void mem_resize_stats(struct mem_resize_stats *stats) {
+    if (default_pool) {
+        mem_pool_resize_stats(default_pool, stats);
+    } else {
+        memset(stats, 0, sizeof(*stats));
+    }
+}
+
+// Deinit function: frees the default memory pool
+void mem_deinit() {
+    if (default_pool) {
+        mem_pool_destroy(default_pool);
+        default_pool = NULL;
+    }
+}
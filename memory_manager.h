@@ -5,15 +5,290 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <stdint.h>
+
+struct mem_cache_stats {
+    size_t alloc_hits;   // Allocations served from a thread cache
+    size_t alloc_misses; // Small allocations that had to go to the pool
+    size_t free_hits;    // Frees kept in a thread cache
+    size_t free_misses;  // Frees of blocks too large to cache
+    size_t refills;      // Batched transfers from the pool into a cache
+    size_t flushes;      // Batched transfers from a full cache back to the pool
+};
+
+struct mem_resize_stats {
+    size_t in_place_grows;   // Grown into the free space right after the block
+    size_t in_place_shrinks; // Truncated, or already large enough
+    size_t moves;            // Copied to a new location
+    size_t failures;         // No room anywhere, the block was left untouched
+};
+
+// Memory behind a pool. MEM_BACKING_MMAP reserves address space with MAP_NORESERVE
+// and commits pages on first touch, falling back to the heap if mmap fails.
+// MEM_BACKING_FILE pools come from mem_pool_open_file.
+enum mem_backing {
+    MEM_BACKING_HEAP,
+    MEM_BACKING_MMAP,
+    MEM_BACKING_FILE,
+};
+
+// Huge pages for mmap-backed pools; each falls back to the next smaller kind
+enum mem_huge_pages {
+    MEM_HUGE_PAGES_NONE,
+    MEM_HUGE_PAGES_TRANSPARENT, // madvise(MADV_HUGEPAGE)
+    MEM_HUGE_PAGES_EXPLICIT,    // MAP_HUGETLB from the reserved hugetlbfs pages
+};
+
+struct mem_stats {
+    size_t pool_bytes;
+    size_t used_bytes;         // Handed out, including blocks parked in thread caches
+    size_t free_bytes;
+    size_t used_blocks;        // Live allocations: allocs - frees
+    size_t free_blocks;        // Free extents
+    size_t largest_free;       // Bytes in the largest free extent
+    double fragmentation;      // 1 - largest_free / free_bytes, 0 when nothing is free
+    size_t allocs;             // Cumulative successful allocations
+    size_t frees;
+    size_t resizes;
+    size_t failed_allocs;
+    double avg_search_length;  // Free blocks examined per free-list search
+    size_t lock_acquires;      // Times the pool's locks were taken
+    size_t lock_contentions;   // Times they were already held
+    uint64_t lock_wait_ns;     // Total time spent waiting for them
+    enum mem_backing backing;  // What the pool actually got after any fallback
+    enum mem_huge_pages huge_pages;
+    size_t chunks;             // 1 unless a growable pool has chained more
+};
+
+// Alignments every pool supports as its minimum; any larger power of two works as well
+#define MEM_ALIGN_DEFAULT 16
+#define MEM_ALIGN_CACHE_LINE 64
+#define MEM_ALIGN_PAGE 4096
+
+// Where an allocation is placed among the free blocks that fit
+enum mem_placement {
+    MEM_PLACEMENT_SEGREGATED, // First fit within the request's size class, else the head of a larger class
+    MEM_PLACEMENT_NEXT_FIT,   // First fitting block in address order after the last allocation
+    MEM_PLACEMENT_BEST_FIT,   // Smallest fitting block, found through a size-ordered tree
+};
+
+// How free space is organised. Buddy pools round every block up to a power of two
+// and allocate and free in O(log pool size) whatever the number of live blocks;
+// their blocks can be aligned up to MEM_ALIGN_PAGE and the placement is ignored.
+enum mem_backend {
+    MEM_BACKEND_FREE_LISTS, // Boundary-tagged blocks on segregated free lists
+    MEM_BACKEND_BUDDY,      // Binary buddy blocks on per-order free lists
+    MEM_BACKEND_BITMAP,     // Boundary-tagged blocks found by a SIMD scan of a free-granule bitmap
+};
+
+// Lock guarding a pool, each of its chunks and shards, or the linked list. Critical
+// sections are short, so under contention spinning can beat the futex sleep and wake
+// of a pthread mutex; the statistics show which kind suits a workload.
+enum mem_lock_kind {
+    MEM_LOCK_PTHREAD,  // pthread mutex
+    MEM_LOCK_TICKET,   // Spinlock granting the lock in arrival order
+    MEM_LOCK_MCS,      // Queue lock granting the lock in arrival order, each waiter spinning on its own entry
+    MEM_LOCK_ADAPTIVE, // Spins about as long as recent waits took, then sleeps on a futex
+};
+
+struct mem_lock_stats {
+    size_t acquires;
+    size_t contentions; // Acquisitions that found the lock held
+    uint64_t wait_ns;   // Total time those spent waiting
+};
+
+struct mem_pool_options {
+    size_t min_alignment; // Power of two every block starts on, 0 for MEM_ALIGN_DEFAULT
+    bool lock_free;       // Allocate from a lock-free bump region covering the whole pool
+    enum mem_placement placement;
+    enum mem_backend backend;
+    enum mem_backing backing;
+    enum mem_huge_pages huge_pages;
+    double growth_factor; // When full, chain a chunk this many times the last one's size, 0 to fail instead
+    size_t max_size;      // Cap on the bytes of all chunks of a growable pool, 0 for none
+    size_t shards;        // Split the pool into this many address ranges with a lock each, 0 or 1 for none
+    enum mem_lock_kind lock;
+};
+
+typedef struct mem_pool mem_pool_t;
+
+mem_pool_t *mem_pool_create(size_t size);
+
+mem_pool_t *mem_pool_create_ex(size_t size, const struct mem_pool_options *options);
+
+mem_pool_t *mem_pool_open_file(const char *path, size_t size, const struct mem_pool_options *options);
+
+void mem_pool_set_root(mem_pool_t *pool, void *root);
+
+void* mem_pool_get_root(mem_pool_t *pool);
+
+size_t mem_pool_offset(mem_pool_t *pool, void *ptr);
+
+void* mem_pool_pointer(mem_pool_t *pool, size_t offset);
+
+int mem_pool_checkpoint(mem_pool_t *pool);
+
+void* mem_pool_alloc(mem_pool_t *pool, size_t size);
+
+void* mem_pool_alloc_aligned(mem_pool_t *pool, size_t size, size_t alignment);
+
+void mem_pool_free(mem_pool_t *pool, void* block);
+
+size_t mem_pool_alloc_batch(mem_pool_t *pool, size_t size, size_t count, void **out_ptrs);
+
+void mem_pool_free_batch(mem_pool_t *pool, void **ptrs, size_t count);
+
+void* mem_pool_resize(mem_pool_t *pool, void* block, size_t size);
+
+bool mem_pool_owns(mem_pool_t *pool, void* ptr);
+
+size_t mem_pool_usable_size(mem_pool_t *pool, void* ptr);
+
+bool mem_pool_set_thread_cache(mem_pool_t *pool, size_t capacity);
+
+void mem_pool_cache_stats(mem_pool_t *pool, struct mem_cache_stats *stats);
+
+void mem_pool_resize_stats(mem_pool_t *pool, struct mem_resize_stats *stats);
+
+void mem_pool_stats(mem_pool_t *pool, struct mem_stats *stats);
+
+void mem_pool_profile_set_rate(mem_pool_t *pool, size_t sample_bytes);
+
+int mem_pool_profile_dump(mem_pool_t *pool, int fd);
+
+int mem_pool_trace_start(mem_pool_t *pool, int fd);
+
+int mem_pool_trace_stop(mem_pool_t *pool);
+
+void mem_pool_destroy(mem_pool_t *pool);
+
+typedef struct mem_region mem_region_t;
+
+mem_region_t *mem_pool_region_create(mem_pool_t *pool, size_t size);
+
+mem_region_t *mem_region_create(size_t size);
+
+void* mem_region_alloc(mem_region_t *region, size_t size);
+
+void mem_region_free(mem_region_t *region, void* ptr);
+
+void mem_region_reset(mem_region_t *region);
+
+void mem_region_destroy(mem_region_t *region);
+
+// Handles name blocks that mem_pool_compact may move while they are not pinned
+typedef uint32_t mem_handle_t;
+
+#define MEM_HANDLE_NONE 0
+
+mem_handle_t mem_pool_handle_alloc(mem_pool_t *pool, size_t size);
+
+mem_handle_t mem_handle_alloc(size_t size);
+
+void mem_pool_handle_free(mem_pool_t *pool, mem_handle_t handle);
+
+void mem_handle_free(mem_handle_t handle);
+
+void* mem_pool_handle_pin(mem_pool_t *pool, mem_handle_t handle);
+
+void* mem_handle_pin(mem_handle_t handle);
+
+void mem_pool_handle_unpin(mem_pool_t *pool, mem_handle_t handle);
+
+void mem_handle_unpin(mem_handle_t handle);
+
+bool mem_pool_compact(mem_pool_t *pool, uint64_t budget_ns);
+
+bool mem_compact(uint64_t budget_ns);
+
+typedef struct mem_slab mem_slab_t;
+
+mem_slab_t *mem_pool_slab_create(mem_pool_t *pool, size_t obj_size, size_t align);
+
+mem_slab_t *mem_slab_create(size_t obj_size, size_t align);
+
+void* mem_slab_alloc(mem_slab_t *slab);
+
+void mem_slab_free(mem_slab_t *slab, void* obj);
+
+void mem_slab_destroy(mem_slab_t *slab);
+
+// Arenas bump-allocate objects that die together and free them all at once
+typedef struct mem_arena mem_arena_t;
+
+mem_arena_t *mem_pool_arena_begin(mem_pool_t *pool, size_t size);
+
+mem_arena_t *mem_arena_begin(size_t size);
+
+void* mem_arena_alloc(mem_arena_t *arena, size_t size);
+
+void mem_arena_reset(mem_arena_t *arena);
+
+void mem_arena_end(mem_arena_t *arena);
+
+// Locks of the kinds in enum mem_lock_kind for structures built on the pools
+typedef struct mem_lock mem_lock_t;
+
+mem_lock_t *mem_lock_create(enum mem_lock_kind kind);
+
+void mem_lock_acquire(mem_lock_t *lock);
+
+void mem_lock_release(mem_lock_t *lock);
+
+void mem_lock_stats(mem_lock_t *lock, struct mem_lock_stats *stats);
+
+void mem_lock_destroy(mem_lock_t *lock);
+
+// The mem_* functions below operate on a default pool created by mem_init
 
 void mem_init(size_t size);
 
+void mem_init_ex(size_t size, const struct mem_pool_options *options);
+
+bool mem_init_file(const char *path, size_t size);
+
+void mem_set_root(void *root);
+
+void* mem_get_root();
+
+size_t mem_offset(void *ptr);
+
+void* mem_pointer(size_t offset);
+
+int mem_checkpoint();
+
 void* mem_alloc(size_t size);
 
+void* mem_alloc_aligned(size_t size, size_t alignment);
+
 void mem_free(void* block);
 
+size_t mem_alloc_batch(size_t size, size_t count, void **out_ptrs);
+
+void mem_free_batch(void **ptrs, size_t count);
+
 void* mem_resize(void* block, size_t size);
 
+bool mem_owns(void* ptr);
+
+size_t mem_usable_size(void* ptr);
+
+bool mem_set_thread_cache(size_t capacity);
+
+void mem_cache_stats(struct mem_cache_stats *stats);
+
+void mem_resize_stats(struct mem_resize_stats *stats);
+
+void mem_stats(struct mem_stats *stats);
+
+void mem_profile_set_rate(size_t sample_bytes);
+
+int mem_profile_dump(int fd);
+
+int mem_trace_start(int fd);
+
+int mem_trace_stop();
+
 void mem_deinit();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,113 @@
+#ifndef MEMORY_MANAGER_INTERNAL_H
+#define MEMORY_MANAGER_INTERNAL_H
+#include "memory_manager.h"
+
+// Pool entry points shared by the allocators layered on top of memory_manager.c
+
+mem_pool_t *mem_default_pool();
+
+void mem_pool_lock_all(mem_pool_t *pool);
+
+void mem_pool_unlock_all(mem_pool_t *pool);
+
+// Locks of the kinds in enum mem_lock_kind, in mem_lock.c. The pools embed theirs
+// rather than creating them; the statistics are updated by the holder and may be read
+// while holding the lock.
+
+// Queue entry of an MCS waiter
+struct mem_lock_waiter {
+    struct mem_lock_waiter *next;
+    uint32_t granted; // Set by the holder ahead when it hands this waiter the lock
+};
+
+struct mem_lock {
+    enum mem_lock_kind kind;
+    uint32_t word;          // Ticket: the ticket being served; adaptive: 0 while free
+    uint32_t next_ticket;
+    uint32_t spin_estimate; // Adaptive: moving average of the spins that won the lock
+    struct mem_lock_waiter *queue; // MCS: the last waiter, or the holder, NULL while free
+    struct mem_lock_waiter holder; // MCS: the holder's queue entry once it holds the lock
+    pthread_mutex_t mutex;
+    struct mem_lock_stats stats;
+};
+
+void mem_lock_init(struct mem_lock *lock, enum mem_lock_kind kind);
+
+void mem_lock_deinit(struct mem_lock *lock);
+
+// Free-run search for MEM_BACKEND_BITMAP pools, in mem_bitmap.c
+
+#define MEM_BITMAP_NONE UINT32_MAX
+
+enum mem_bitmap_kernel { MEM_BITMAP_SCALAR, MEM_BITMAP_SSE2, MEM_BITMAP_AVX2 };
+
+bool mem_bitmap_set_kernel(enum mem_bitmap_kernel kernel);
+
+enum mem_bitmap_kernel mem_bitmap_kernel();
+
+uint32_t mem_bitmap_find_run(const uint64_t *map, uint32_t words, uint32_t n);
+
+uint32_t mem_bitmap_longest_run(const uint64_t *map, uint32_t words);
+
+void mem_bitmap_fill(uint64_t *map, uint32_t index, uint32_t count, bool set);
+
+// Sampling heap profiler behind mem_pool_profile_set_rate, in mem_profile.c
+
+typedef struct mem_profiler mem_profiler_t;
+
+mem_profiler_t *mem_profiler_create();
+
+void mem_profiler_set_rate(mem_profiler_t *profiler, size_t sample_bytes);
+
+void mem_profiler_alloc(mem_profiler_t *profiler, void *ptr, size_t size);
+
+void mem_profiler_free(mem_profiler_t *profiler, void *ptr);
+
+void mem_profiler_resize(mem_profiler_t *profiler, void *old_ptr, void *ptr, size_t size);
+
+int mem_profiler_dump(mem_profiler_t *profiler, int fd);
+
+void mem_profiler_destroy(mem_profiler_t *profiler);
+
+// Allocation tracer behind mem_pool_trace_start, in mem_trace.c. A trace is a header
+// followed by fixed-size records, both in the host's byte order; mem_replay reads it.
+
+#define MEM_TRACE_MAGIC "MEMTRACE"
+#define MEM_TRACE_VERSION 1
+
+enum mem_trace_op { MEM_TRACE_ALLOC = 1, MEM_TRACE_FREE, MEM_TRACE_RESIZE };
+
+struct mem_trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+struct mem_trace_record {
+    uint64_t time_ns;   // Since the trace started
+    uint64_t size;      // Requested bytes, 0 for frees
+    uint32_t id;        // Block id, numbered from 1 at allocation and kept through resizes
+    uint16_t thread;    // Recording thread, numbered from 1 in order of first use
+    uint8_t op;         // enum mem_trace_op
+    uint8_t align_log2; // Requested alignment, 0 for the pool's own
+};
+
+typedef struct mem_tracer mem_tracer_t;
+
+mem_tracer_t *mem_tracer_create();
+
+int mem_tracer_start(mem_tracer_t *tracer, int fd);
+
+int mem_tracer_stop(mem_tracer_t *tracer);
+
+void mem_tracer_alloc(mem_tracer_t *tracer, void *ptr, size_t size, size_t alignment);
+
+void mem_tracer_free(mem_tracer_t *tracer, void *ptr);
+
+uint32_t mem_tracer_resize_begin(mem_tracer_t *tracer, void *old_ptr);
+
+void mem_tracer_resize_end(mem_tracer_t *tracer, uint32_t id, void *old_ptr, void *ptr, size_t size);
+
+void mem_tracer_destroy(mem_tracer_t *tracer);
+
+#endif
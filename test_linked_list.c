@@ -52,9 +52,12 @@ void test_list_init()
 {
     printf_yellow(" Testing list_init ---> ");
     Node *head = NULL;
-    list_init(&head, sizeof(Node));
+    my_assert(list_init(&head, sizeof(Node)));
     my_assert(head == NULL);
     list_cleanup(&head);
+    // A pool too large to create leaves the list uninitialised rather than crashing later
+    my_assert(!list_init(&head, SIZE_MAX));
+    my_assert(head == NULL);
     printf_green("[PASS].\n");
 }
 
@@ -327,6 +330,47 @@ void test_list_edge_cases()
     printf_green("[PASS].\n");
 }
 
+#define LIST_LOCK_THREADS 4
+#define LIST_LOCK_INSERTS 500
+
+void *list_lock_worker(void *arg)
+{
+    Node **head = arg;
+    for (int i = 0; i < LIST_LOCK_INSERTS; i++)
+    {
+        list_insert(head, i);
+    }
+    return NULL;
+}
+
+void test_list_lock_kinds()
+{
+    printf_yellow(" Testing list lock kinds ---> ");
+    // Concurrent inserts lose no node under any kind of lock
+    for (int kind = MEM_LOCK_PTHREAD; kind <= MEM_LOCK_ADAPTIVE; kind++)
+    {
+        Node *head = NULL;
+        my_assert(list_init_ex(&head, sizeof(Node) * LIST_LOCK_THREADS * LIST_LOCK_INSERTS, kind));
+        pthread_t threads[LIST_LOCK_THREADS];
+        for (int t = 0; t < LIST_LOCK_THREADS; t++)
+        {
+            pthread_create(&threads[t], NULL, list_lock_worker, &head);
+        }
+        for (int t = 0; t < LIST_LOCK_THREADS; t++)
+        {
+            pthread_join(threads[t], NULL);
+        }
+        my_assert(list_count_nodes(&head) == LIST_LOCK_THREADS * LIST_LOCK_INSERTS);
+
+        struct mem_lock_stats stats;
+        list_lock_stats(&stats);
+        my_assert(stats.acquires >= LIST_LOCK_THREADS * LIST_LOCK_INSERTS + 1);
+        my_assert(stats.contentions <= stats.acquires);
+        list_cleanup(&head);
+    }
+    printf_green("[PASS].\n");
+}
+
 // Main function to run all tests
 int main(int argc, char *argv[])
 {
@@ -351,6 +395,7 @@ int main(int argc, char *argv[])
         printf(" 12. test_list_delete_loop - Test multiple detelions\n");
         printf(" 13. test_list_search_loop - Test multiple search\n");
         printf(" 14. test_list_edge_cases - Test edge cases\n");
+        printf(" 15. test_list_lock_kinds - Test concurrent inserts under each kind of lock\n");
         printf(" 0. Run all tests\n");
         return 1;
     }
@@ -375,6 +420,7 @@ int main(int argc, char *argv[])
         test_list_delete_loop(1000);
         test_list_search_loop(1000);
         test_list_edge_cases();
+        test_list_lock_kinds();
         break;
     case 1:
         test_list_init();
@@ -419,6 +465,9 @@ int main(int argc, char *argv[])
     case 14:
         test_list_edge_cases();
         break;
+    case 15:
+        test_list_lock_kinds();
+        break;
 
     default:
         printf("Invalid test function\n");
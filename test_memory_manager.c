@@ -1,9 +1,13 @@
 #include "memory_manager.h"
+#include "memory_manager_internal.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <assert.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 #include "common_defs.h"
 
 const char *git_date = "2024-09-24 11:34";
@@ -322,6 +326,1444 @@ void test_edge_case_allocations()
     printf_green("[PASS].\n");
 }
 
+void test_size_class_reuse()
+{
+    printf_yellow(" Testing size class reuse ---> ");
+    mem_init(64 * 1024);
+
+    const int num_blocks = 256;
+    void *blocks[num_blocks];
+    for (int i = 0; i < num_blocks; i++)
+    {
+        blocks[i] = mem_alloc(16 + (i % 8) * 16); // Sizes from 16 to 128 bytes
+        my_assert(blocks[i] != NULL);
+    }
+
+    // Free every other block, leaving holes of known sizes between live blocks
+    for (int i = 0; i < num_blocks; i += 2)
+    {
+        mem_free(blocks[i]);
+    }
+
+    // Allocating the same sizes again should land exactly in the holes
+    for (int i = 0; i < num_blocks; i += 2)
+    {
+        void *block = mem_alloc(16 + (i % 8) * 16);
+        my_assert(block != NULL);
+        my_assert(block <= blocks[num_blocks - 1]);
+        blocks[i] = block;
+    }
+
+    for (int i = 0; i < num_blocks; i++)
+    {
+        mem_free(blocks[i]);
+    }
+
+    void *whole = mem_alloc(64 * 1024); // Everything must have coalesced back
+    my_assert(whole != NULL);
+    mem_free(whole);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void test_resize_preserves_data()
+{
+    printf_yellow(" Testing data preservation across free and resize ---> ");
+    mem_init(1024);
+
+    unsigned char *block1 = mem_alloc(256);
+    unsigned char *block2 = mem_alloc(256);
+    unsigned char *block3 = mem_alloc(512);
+    memset(block1, 0x11, 256);
+    memset(block2, 0x22, 256);
+    memset(block3, 0x33, 512);
+
+    // Freeing the neighbours must not disturb the live block in between
+    mem_free(block1);
+    mem_free(block3);
+    for (int i = 0; i < 256; i++)
+    {
+        my_assert(block2[i] == 0x22);
+    }
+
+    // Only the merged space of the block and both neighbours can hold 1000 bytes
+    unsigned char *moved = mem_resize(block2, 1000);
+    my_assert(moved == block1);
+    for (int i = 0; i < 256; i++)
+    {
+        my_assert(moved[i] == 0x22);
+    }
+
+    mem_free(moved);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void test_owns_and_usable_size()
+{
+    printf_yellow(" Testing mem_owns and mem_usable_size ---> ");
+    mem_init(1024);
+
+    char *block1 = mem_alloc(100);
+    char *block2 = mem_alloc(200);
+    my_assert(mem_owns(block1));
+    my_assert(mem_owns(block2));
+    my_assert(mem_usable_size(block1) >= 100);
+    my_assert(mem_usable_size(block2) >= 200);
+
+    // Interior and foreign pointers are not blocks of the pool
+    int local;
+    my_assert(!mem_owns(block1 + 1));
+    my_assert(!mem_owns(&local));
+    my_assert(mem_usable_size(&local) == 0);
+
+    // A freed block is no longer owned, even after merging with its neighbour
+    mem_free(block1);
+    mem_free(block2);
+    my_assert(!mem_owns(block1));
+    my_assert(!mem_owns(block2));
+    my_assert(mem_usable_size(block2) == 0);
+
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+#define CACHE_TEST_THREADS 4
+#define CACHE_TEST_BLOCKS 100
+
+my_barrier_t cache_test_barrier;
+
+void *cache_test_worker(void *arg)
+{
+    unsigned char id = (unsigned char)(size_t)arg;
+    unsigned char *blocks[CACHE_TEST_BLOCKS];
+
+    for (int round = 0; round < 10; round++)
+    {
+        for (int i = 0; i < CACHE_TEST_BLOCKS; i++)
+        {
+            blocks[i] = mem_alloc(32 + (i % 4) * 16);
+            my_assert(blocks[i] != NULL);
+            memset(blocks[i], id, 32);
+        }
+        my_barrier_wait(&cache_test_barrier); // Every thread holds its blocks now
+
+        for (int i = 0; i < CACHE_TEST_BLOCKS; i++)
+        {
+            for (int k = 0; k < 32; k++)
+            {
+                my_assert(blocks[i][k] == id); // No block was handed to two threads
+            }
+            mem_free(blocks[i]);
+        }
+    }
+    return NULL;
+}
+
+void test_thread_cache()
+{
+    printf_yellow(" Testing thread caches ---> ");
+    mem_init(64 * 1024);
+    mem_set_thread_cache(64);
+
+    // Repeating the same size is served from the cache after the first refill
+    for (int i = 0; i < 100; i++)
+    {
+        void *block = mem_alloc(64);
+        my_assert(block != NULL);
+        mem_free(block);
+    }
+    struct mem_cache_stats stats;
+    mem_cache_stats(&stats);
+    my_assert(stats.alloc_hits >= 99);
+    my_assert(stats.refills >= 1);
+
+    // A cached block counts as freed
+    void *block = mem_alloc(64);
+    mem_free(block);
+    my_assert(!mem_owns(block));
+    mem_free(block); // Double free is ignored
+
+    pthread_t threads[CACHE_TEST_THREADS];
+    my_barrier_init(&cache_test_barrier, CACHE_TEST_THREADS);
+    for (int t = 0; t < CACHE_TEST_THREADS; t++)
+    {
+        pthread_create(&threads[t], NULL, cache_test_worker, (void *)(size_t)(t + 1));
+    }
+    for (int t = 0; t < CACHE_TEST_THREADS; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+    my_barrier_destroy(&cache_test_barrier);
+
+    // Exited threads flushed their caches, so the whole pool is available again
+    // once this thread's cache is given back by the failing allocation
+    void *whole = mem_alloc(64 * 1024);
+    my_assert(whole != NULL);
+    mem_free(whole);
+
+    mem_cache_stats(&stats);
+    my_assert(stats.alloc_hits + stats.alloc_misses >= 100 + CACHE_TEST_THREADS * CACHE_TEST_BLOCKS * 10);
+
+    // Turning caching off gives this thread's cached blocks back to the pool
+    block = mem_alloc(64);
+    mem_free(block);
+    mem_set_thread_cache(0);
+    struct mem_stats pool_stats;
+    mem_stats(&pool_stats);
+    my_assert(pool_stats.used_bytes == 0 && pool_stats.free_blocks == 1);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void test_independent_pools()
+{
+    printf_yellow(" Testing independent pools ---> ");
+    mem_init(1024);
+    mem_pool_t *pool1 = mem_pool_create(512);
+    mem_pool_t *pool2 = mem_pool_create(512);
+    my_assert(pool1 != NULL && pool2 != NULL);
+
+    // Each pool has its own capacity, unaffected by the others
+    void *block1 = mem_pool_alloc(pool1, 512);
+    void *block2 = mem_pool_alloc(pool2, 512);
+    void *block3 = mem_alloc(1024);
+    my_assert(block1 != NULL && block2 != NULL && block3 != NULL);
+    my_assert(mem_pool_alloc(pool1, 16) == NULL);
+
+    // Blocks belong only to the pool that handed them out
+    my_assert(mem_pool_owns(pool1, block1));
+    my_assert(!mem_pool_owns(pool2, block1));
+    my_assert(!mem_owns(block1));
+    mem_pool_free(pool2, block1); // Ignored, block1 is not from pool2
+    my_assert(mem_pool_owns(pool1, block1));
+
+    mem_pool_free(pool1, block1);
+    my_assert(mem_pool_alloc(pool1, 16) != NULL);
+
+    mem_pool_destroy(pool1);
+    mem_pool_destroy(pool2);
+    mem_free(block3);
+
+    // Pools without thread caches take no pthread key, so there can be more of them
+    // than keys, and each one can still turn caching on
+    mem_pool_t *pools[PTHREAD_KEYS_MAX + 16];
+    for (int i = 0; i < PTHREAD_KEYS_MAX + 16; i++)
+    {
+        pools[i] = mem_pool_create(64);
+        my_assert(pools[i] != NULL);
+    }
+    my_assert(mem_pool_set_thread_cache(pools[PTHREAD_KEYS_MAX + 15], 8));
+    void *cached = mem_pool_alloc(pools[PTHREAD_KEYS_MAX + 15], 16);
+    mem_pool_free(pools[PTHREAD_KEYS_MAX + 15], cached);
+    for (int i = 0; i < PTHREAD_KEYS_MAX + 16; i++)
+    {
+        mem_pool_destroy(pools[i]);
+    }
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void test_resize_in_place()
+{
+    printf_yellow(" Testing in-place resize ---> ");
+    mem_init(1024);
+
+    char *block = mem_alloc(100);
+    memset(block, 0x5a, 100);
+
+    // The space after the only block is free, so growing keeps the address
+    char *grown = mem_resize(block, 600);
+    my_assert(grown == block);
+    my_assert(grown[99] == 0x5a);
+
+    // Shrinking never moves and gives the tail back to the pool
+    char *shrunk = mem_resize(grown, 64);
+    my_assert(shrunk == block);
+    void *tail = mem_alloc(900);
+    my_assert(tail == block + 64);
+
+    // With the neighbour taken the block has to move to grow
+    char *moved = mem_resize(shrunk, 128);
+    my_assert(moved == NULL); // 64 + 900 rounded leaves no room for 128 elsewhere
+    mem_free(tail);
+    tail = mem_alloc(16);
+    moved = mem_resize(shrunk, 128);
+    my_assert(moved != NULL && moved != shrunk);
+    my_assert(moved[63] == 0x5a);
+
+    struct mem_resize_stats stats;
+    mem_resize_stats(&stats);
+    my_assert(stats.in_place_grows == 1);
+    my_assert(stats.in_place_shrinks == 1);
+    my_assert(stats.moves == 1);
+    my_assert(stats.failures == 1);
+
+    mem_free(moved);
+    mem_free(tail);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void test_slab_allocator()
+{
+    printf_yellow(" Testing slab allocator ---> ");
+    mem_init(64 * 1024);
+    mem_slab_t *slab = mem_slab_create(24, 8);
+    my_assert(slab != NULL);
+
+    // Objects are aligned, distinct and packed without per-object headers
+    const int num_objects = 500;
+    char *objects[num_objects];
+    for (int i = 0; i < num_objects; i++)
+    {
+        objects[i] = mem_slab_alloc(slab);
+        my_assert(objects[i] != NULL);
+        my_assert((size_t)objects[i] % 8 == 0);
+        memset(objects[i], i & 0xff, 24);
+    }
+    my_assert(objects[1] - objects[0] == 24);
+    for (int i = 0; i < num_objects; i++)
+    {
+        my_assert(objects[i][23] == (char)(i & 0xff));
+    }
+
+    // Freed objects are reused, a double free is ignored
+    char *first = objects[0];
+    mem_slab_free(slab, first);
+    mem_slab_free(slab, first);
+    objects[0] = mem_slab_alloc(slab);
+    my_assert(objects[0] == first);
+    my_assert(mem_slab_alloc(slab) != first);
+
+    // Pointers from elsewhere are ignored, even when the slab header their address
+    // masks to would lie in unmapped memory
+    mem_slab_free(slab, (void *)((uintptr_t)objects[1] & 0xffff));
+    char *plain = mem_alloc(24);
+    mem_slab_free(slab, plain);
+    my_assert(mem_owns(plain));
+    mem_free(plain);
+
+    mem_slab_destroy(slab);
+
+    // Destroying the slab cache gives all of its memory back to the pool
+    void *whole = mem_alloc(64 * 1024);
+    my_assert(whole != NULL);
+    mem_free(whole);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void test_aligned_allocation()
+{
+    printf_yellow(" Testing aligned allocation ---> ");
+    mem_init(64 * 1024);
+
+    void *small = mem_alloc(10);
+    void *line = mem_alloc_aligned(100, MEM_ALIGN_CACHE_LINE);
+    void *page = mem_alloc_aligned(100, MEM_ALIGN_PAGE);
+    void *plain = mem_alloc_aligned(10, MEM_ALIGN_DEFAULT);
+    my_assert(small && line && page && plain);
+    my_assert((uintptr_t)line % MEM_ALIGN_CACHE_LINE == 0);
+    my_assert((uintptr_t)page % MEM_ALIGN_PAGE == 0);
+    my_assert((uintptr_t)plain % MEM_ALIGN_DEFAULT == 0);
+    my_assert(mem_alloc_aligned(10, 48) == NULL); // Not a power of two
+    my_assert(mem_alloc_aligned(100, (size_t)1 << 36) == NULL); // Wider than the pool
+    my_assert(mem_alloc_aligned(100, (size_t)1 << 62) == NULL);
+
+    // Growing past the neighbour moves the block but keeps its alignment
+    memset(page, 0x3c, 100);
+    void *blocker = mem_alloc(4096); // Too big for the gaps below the page, so it follows it
+    char *moved = mem_resize(page, 8192);
+    my_assert(moved != NULL && moved != page);
+    my_assert((uintptr_t)moved % MEM_ALIGN_PAGE == 0);
+    my_assert(moved[99] == 0x3c);
+    moved = mem_resize(moved, 32);
+    my_assert((uintptr_t)moved % MEM_ALIGN_PAGE == 0);
+
+    mem_free(small);
+    mem_free(line);
+    mem_free(plain);
+    mem_free(blocker);
+    mem_free(moved);
+    mem_deinit();
+
+    // A pool-wide minimum applies to every allocation, including resized ones
+    struct mem_pool_options options = {.min_alignment = MEM_ALIGN_CACHE_LINE};
+    mem_init_ex(4096, &options);
+    void *blocks[8];
+    for (int i = 0; i < 8; i++)
+    {
+        blocks[i] = mem_alloc(i * 7 + 1);
+        my_assert(blocks[i] != NULL && (uintptr_t)blocks[i] % MEM_ALIGN_CACHE_LINE == 0);
+    }
+    mem_free(blocks[3]);
+    blocks[3] = NULL;
+    blocks[2] = mem_resize(blocks[2], 200);
+    my_assert(blocks[2] != NULL && (uintptr_t)blocks[2] % MEM_ALIGN_CACHE_LINE == 0);
+    for (int i = 0; i < 8; i++)
+    {
+        mem_free(blocks[i]);
+    }
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void test_batch_allocation()
+{
+    printf_yellow(" Testing batch allocation ---> ");
+    mem_init(100 * 32);
+
+    // A fresh pool holds the whole batch in one run, so the blocks are back to back
+    void *blocks[120];
+    size_t count = mem_alloc_batch(24, 64, blocks);
+    my_assert(count == 64);
+    for (int i = 0; i < 64; i++)
+    {
+        memset(blocks[i], i, 24);
+        if (i > 0)
+        {
+            my_assert((char *)blocks[i] == (char *)blocks[i - 1] + 32);
+        }
+    }
+    for (int i = 0; i < 64; i++)
+    {
+        my_assert(((char *)blocks[i])[23] == i);
+    }
+
+    // Only 36 more fit; the remaining slots are cleared
+    count = mem_alloc_batch(24, 56, blocks + 64);
+    my_assert(count == 36);
+    my_assert(blocks[100] == NULL && blocks[119] == NULL);
+
+    // Freeing in any order, with duplicates and NULLs, coalesces the whole pool
+    void *reversed[102];
+    for (int i = 0; i < 100; i++)
+    {
+        reversed[i] = blocks[99 - i];
+    }
+    reversed[100] = blocks[5];
+    reversed[101] = NULL;
+    mem_free_batch(reversed, 102);
+    my_assert(reversed[0] == blocks[99] && reversed[99] == blocks[0]); // Left in the caller's order
+    void *whole = mem_alloc(100 * 32);
+    my_assert(whole == blocks[0]);
+
+    mem_free(whole);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+mem_region_t *region_test_region;
+
+void *region_test_worker(void *arg)
+{
+    unsigned char id = (unsigned char)(size_t)arg;
+    unsigned char *blocks[CACHE_TEST_BLOCKS];
+
+    for (int round = 0; round < 10; round++)
+    {
+        for (int i = 0; i < CACHE_TEST_BLOCKS; i++)
+        {
+            blocks[i] = mem_region_alloc(region_test_region, 32 + (i % 4) * 16);
+            my_assert(blocks[i] != NULL);
+            memset(blocks[i], id, 32);
+        }
+        for (int i = 0; i < CACHE_TEST_BLOCKS; i++)
+        {
+            for (int k = 0; k < 32; k++)
+            {
+                my_assert(blocks[i][k] == id); // No block was handed to two threads
+            }
+            mem_region_free(region_test_region, blocks[i]);
+        }
+    }
+    return NULL;
+}
+
+void test_lock_free_region()
+{
+    printf_yellow(" Testing lock-free regions ---> ");
+    mem_init(64 * 1024);
+
+    // A region fills up by bumping and is emptied at once by a reset
+    mem_region_t *region = mem_region_create(1024);
+    my_assert(region != NULL);
+    char *first = mem_region_alloc(region, 16);
+    int count = 1;
+    while (mem_region_alloc(region, 16) != NULL)
+    {
+        count++;
+    }
+    my_assert(count == 64);
+    mem_region_reset(region);
+    my_assert(mem_region_alloc(region, 16) == first);
+
+    // A freed block is recycled by the next request of its size class
+    void *block = mem_region_alloc(region, 40);
+    mem_region_free(region, block);
+    mem_region_free(region, block); // Double free is ignored
+    my_assert(mem_region_alloc(region, 48) == block);
+
+    // The pool neither owns nor frees a region's blocks, with or without a thread cache
+    my_assert(!mem_owns(block) && mem_usable_size(block) == 0);
+    mem_free(block);
+    void *other = mem_alloc(48);
+    my_assert(other != NULL && other != block);
+    mem_free(other);
+    my_assert(mem_pool_set_thread_cache(mem_default_pool(), 16));
+    mem_free(block);
+    other = mem_alloc(48);
+    my_assert(other != NULL && other != block);
+    mem_free(other);
+    my_assert(mem_pool_set_thread_cache(mem_default_pool(), 0));
+    mem_region_free(region, block);
+    my_assert(mem_region_alloc(region, 48) == block); // Still the region's, and live until now
+    mem_region_destroy(region);
+
+    // The region's space, including its one-granule header, went back to the pool
+    void *whole = mem_alloc(64 * 1024);
+    my_assert(whole == first - 16);
+    mem_free(whole);
+    mem_deinit();
+
+    // Threads share one region without taking the pool lock
+    mem_init(64 * 1024);
+    region_test_region = mem_region_create(32 * 1024);
+    pthread_t threads[CACHE_TEST_THREADS];
+    for (int t = 0; t < CACHE_TEST_THREADS; t++)
+    {
+        pthread_create(&threads[t], NULL, region_test_worker, (void *)(size_t)(t + 1));
+    }
+    for (int t = 0; t < CACHE_TEST_THREADS; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+    mem_region_destroy(region_test_region);
+    mem_deinit();
+
+    // A lock-free pool routes the whole mem_* API through a region
+    struct mem_pool_options options = {.lock_free = true};
+    mem_init_ex(4096, &options);
+    char *a = mem_alloc(600);
+    char *b = mem_alloc(600);
+    my_assert(a != NULL && b == a + 1024); // 600 bytes round up to the 1024-byte class
+    my_assert(mem_owns(a) && mem_usable_size(a) == 1024);
+    memset(a, 0x77, 600);
+    char *grown = mem_resize(a, 1000);
+    my_assert(grown == a);
+    grown = mem_resize(a, 1500);
+    my_assert(grown != NULL && grown != a && grown[599] == 0x77);
+    my_assert(!mem_owns(a));
+    my_assert(mem_alloc(1024) == a);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void test_allocator_stats()
+{
+    printf_yellow(" Testing allocator statistics ---> ");
+    mem_init(1024);
+
+    struct mem_stats stats;
+    mem_stats(&stats);
+    my_assert(stats.pool_bytes == 1024 && stats.free_bytes == 1024);
+    my_assert(stats.free_blocks == 1 && stats.largest_free == 1024);
+    my_assert(stats.fragmentation == 0.0);
+
+    void *a = mem_alloc(100);
+    void *b = mem_alloc(200);
+    void *c = mem_alloc(100);
+    mem_free(b);
+    my_assert(mem_alloc(700) == NULL); // 800 bytes are free, but not in one piece
+    a = mem_resize(a, 50);
+
+    // a shrank to 64 bytes, its tail merged with b's hole; c and the pool tail follow
+    mem_stats(&stats);
+    my_assert(stats.used_bytes == 64 + 112);
+    my_assert(stats.free_bytes == 1024 - 64 - 112);
+    my_assert(stats.free_blocks == 2);
+    my_assert(stats.largest_free == 1024 - 432);
+    my_assert(stats.fragmentation > 0.0 && stats.fragmentation < 1.0);
+    my_assert(stats.allocs == 3 && stats.frees == 1 && stats.used_blocks == 2);
+    my_assert(stats.resizes == 1 && stats.failed_allocs == 1);
+    my_assert(stats.avg_search_length > 0.0);
+    my_assert(stats.lock_contentions == 0);
+
+    mem_free(a);
+    mem_free(c);
+    mem_stats(&stats);
+    my_assert(stats.used_blocks == 0 && stats.free_blocks == 1 && stats.fragmentation == 0.0);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+// Leaves a 40-granule hole followed by a 36-granule one and allocates 33 granules
+char *placement_pick(enum mem_placement placement, char **low_hole, char **high_hole)
+{
+    struct mem_pool_options options = {.placement = placement};
+    mem_init_ex(64 * 1024, &options);
+    *low_hole = mem_alloc(40 * 16);
+    mem_alloc(16);
+    *high_hole = mem_alloc(36 * 16);
+    mem_alloc(16);
+    mem_free(*high_hole);
+    mem_free(*low_hole);
+    return mem_alloc(33 * 16);
+}
+
+void test_placement_policies()
+{
+    printf_yellow(" Testing placement policies ---> ");
+    char *low, *high;
+
+    my_assert(placement_pick(MEM_PLACEMENT_SEGREGATED, &low, &high) == low);
+    mem_deinit();
+    my_assert(placement_pick(MEM_PLACEMENT_BEST_FIT, &low, &high) == high);
+    mem_deinit();
+
+    // Next fit continues after the last allocation instead of reusing the low hole
+    struct mem_pool_options options = {.placement = MEM_PLACEMENT_NEXT_FIT};
+    mem_init_ex(1600, &options);
+    char *a = mem_alloc(160);
+    char *b = mem_alloc(160);
+    mem_free(a);
+    my_assert(mem_alloc(16) == b + 160);
+    my_assert(mem_alloc(1600 - 336) == b + 176); // Exactly the rest of the pool
+    my_assert(mem_alloc(16) == a); // Wraps around
+    mem_deinit();
+
+    // A mixed workload keeps every policy consistent down to a fully coalesced pool
+    for (int policy = MEM_PLACEMENT_SEGREGATED; policy <= MEM_PLACEMENT_BEST_FIT; policy++)
+    {
+        options.placement = policy;
+        mem_init_ex(64 * 1024, &options);
+        void *blocks[64] = {NULL};
+        for (int i = 0; i < 2000; i++)
+        {
+            int slot = (i * 37) % 64;
+            if (blocks[slot])
+            {
+                mem_free(blocks[slot]);
+                blocks[slot] = NULL;
+            }
+            else if (i % 5 == 0)
+            {
+                blocks[slot] = mem_alloc_aligned((i * 13) % 700 + 1, MEM_ALIGN_CACHE_LINE);
+                my_assert(blocks[slot] && (uintptr_t)blocks[slot] % MEM_ALIGN_CACHE_LINE == 0);
+            }
+            else
+            {
+                blocks[slot] = mem_alloc((i * 13) % 900 + 1);
+                my_assert(blocks[slot] != NULL);
+            }
+        }
+        for (int i = 0; i < 64; i++)
+        {
+            mem_free(blocks[i]);
+        }
+        struct mem_stats stats;
+        mem_stats(&stats);
+        my_assert(stats.free_blocks == 1 && stats.largest_free == 64 * 1024);
+        mem_deinit();
+    }
+    printf_green("[PASS].\n");
+}
+
+void test_mmap_backing()
+{
+    printf_yellow(" Testing mmap-backed pools ---> ");
+
+    // A large reservation is cheap: only the pages that are touched get committed
+    struct mem_pool_options options = {.backing = MEM_BACKING_MMAP, .huge_pages = MEM_HUGE_PAGES_TRANSPARENT};
+    size_t size = (size_t)1 << 30;
+    mem_init_ex(size, &options);
+    struct mem_stats stats;
+    mem_stats(&stats);
+    my_assert(stats.backing == MEM_BACKING_MMAP);
+    my_assert(stats.huge_pages != MEM_HUGE_PAGES_EXPLICIT);
+    my_assert(stats.free_bytes == size);
+
+    char *big = mem_alloc(size / 2);
+    char *small = mem_alloc(100);
+    my_assert(big != NULL && small == big + size / 2);
+    big[0] = 1;
+    big[size / 2 - 1] = 2;
+    small[99] = 3;
+    my_assert(big[0] + big[size / 2 - 1] + small[99] == 6);
+    mem_free(big);
+    mem_free(small);
+    mem_deinit();
+
+    // Block sizes live in 32-bit tags, so pools of 16 GiB or more are refused
+    my_assert(mem_pool_create_ex((size_t)16 << 30, &options) == NULL);
+    my_assert(mem_pool_create_ex(SIZE_MAX, NULL) == NULL);
+
+    // Explicit huge pages fall back when none are reserved
+    options.huge_pages = MEM_HUGE_PAGES_EXPLICIT;
+    mem_init_ex(4 * 1024 * 1024, &options);
+    mem_stats(&stats);
+    my_assert(stats.backing == MEM_BACKING_MMAP);
+    void *block = mem_alloc(3 * 1024 * 1024);
+    my_assert(block != NULL);
+    memset(block, 0x11, 3 * 1024 * 1024);
+    mem_free(block);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void test_growable_pool()
+{
+    printf_yellow(" Testing growable pools ---> ");
+    struct mem_pool_options options = {.growth_factor = 2.0, .max_size = 16 * 1024};
+    mem_init_ex(1024, &options);
+    struct mem_stats stats;
+
+    // Filling the first chunk chains a second one twice its size, then a third
+    char *a = mem_alloc(1024);
+    char *b = mem_alloc(512);
+    char *c = mem_alloc(3000);
+    my_assert(a && b && c);
+    memset(b, 0x42, 512);
+    mem_stats(&stats);
+    my_assert(stats.chunks == 3 && stats.pool_bytes == 1024 + 2048 + 4096);
+    my_assert(mem_owns(b) && mem_usable_size(c) == 3008);
+
+    // Moving b out empties the second chunk, which is released
+    b = mem_resize(b, 5000);
+    my_assert(b != NULL && b[511] == 0x42);
+    mem_stats(&stats);
+    my_assert(stats.chunks == 3 && stats.pool_bytes == 1024 + 4096 + 8192);
+
+    // The cap stops further growth
+    my_assert(mem_alloc(4000) == NULL);
+
+    mem_free(b);
+    mem_free(c);
+    mem_stats(&stats);
+    my_assert(stats.chunks == 1 && stats.used_blocks == 1);
+
+    // Batches spill over into new chunks and drain out of them
+    void *blocks[30];
+    my_assert(mem_alloc_batch(100, 30, blocks) == 30);
+    mem_stats(&stats);
+    my_assert(stats.chunks == 3); // 18 blocks fit in 2048 bytes, the rest needs another chunk
+    mem_free_batch(blocks, 30);
+    mem_free(a);
+    mem_stats(&stats);
+    my_assert(stats.chunks == 1 && stats.used_blocks == 0 && stats.free_bytes == 1024);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+struct persistent_node {
+    size_t next; // Offset of the next node, 0 at the end
+    int value;
+};
+
+// Overwrites one byte of a file, to stand in for a crash or corruption
+void file_poke(const char *path, long offset, unsigned char value)
+{
+    FILE *file = fopen(path, "r+b");
+    my_assert(file != NULL);
+    fseek(file, offset, SEEK_SET);
+    fputc(value, file);
+    fclose(file);
+}
+
+void test_file_backed_pool()
+{
+    printf_yellow(" Testing file-backed pools ---> ");
+    const char *path = "/tmp/test_memory_manager.pool";
+    remove(path);
+    my_assert(mem_init_file(path, 4096));
+    struct mem_stats stats;
+    mem_stats(&stats);
+    my_assert(stats.backing == MEM_BACKING_FILE && stats.free_bytes == 4096);
+
+    // A list linked by offsets, found again through the root slot
+    struct persistent_node *head = mem_alloc(sizeof(*head));
+    head->value = 0;
+    head->next = 0;
+    struct persistent_node *tail = head;
+    for (int i = 1; i < 10; i++)
+    {
+        struct persistent_node *node = mem_alloc(sizeof(*node));
+        node->value = i;
+        node->next = 0;
+        tail->next = mem_offset(node);
+        tail = node;
+    }
+    void *gap = mem_alloc(200);
+    mem_free(gap);
+    mem_set_root(head);
+    my_assert(mem_get_root() == head);
+    my_assert(mem_checkpoint() == 0);
+
+    // A block left in the thread cache at close is reclaimed on reopening
+    mem_set_thread_cache(true);
+    mem_free(mem_alloc(64));
+    mem_deinit();
+
+    // Reopening takes the stored size and rebuilds the free space around the list
+    my_assert(mem_init_file(path, 0));
+    mem_stats(&stats);
+    my_assert(stats.pool_bytes == 4096 && stats.used_blocks == 10 && stats.free_bytes == 4096 - 10 * 16);
+    head = mem_get_root();
+    my_assert(head != NULL);
+    int count = 0;
+    for (struct persistent_node *node = head; ; node = mem_pointer(node->next))
+    {
+        my_assert(node->value == count);
+        count++;
+        if (!node->next)
+        {
+            break;
+        }
+    }
+    my_assert(count == 10);
+    my_assert(mem_alloc(4096 - 10 * 16) != NULL);
+    mem_deinit();
+
+    // A file still marked open, as a crash leaves it, is checked before use: intact
+    // tags reopen, but a stray start bit inside a block gets the file refused for good
+    const long clean_flag = 32; // In the header, after the magic, size, alignment and root
+    const long start_bits = 4096 + 4096; // After the header and the pool
+    file_poke(path, clean_flag, 0);
+    my_assert(mem_init_file(path, 0));
+    mem_stats(&stats);
+    my_assert(stats.used_blocks == 11 && stats.free_bytes == 0);
+    mem_deinit();
+    file_poke(path, clean_flag, 0);
+    file_poke(path, start_bits + 200 / 8, 1 << (200 % 8));
+    my_assert(!mem_init_file(path, 0));
+    my_assert(!mem_init_file(path, 0));
+    my_assert(mem_offset(head) == 0 && mem_pointer(0) == NULL); // No pool to resolve them
+
+    // A mismatched size is refused
+    my_assert(!mem_init_file(path, 8192));
+    remove(path);
+    printf_green("[PASS].\n");
+}
+
+void test_buddy_backend()
+{
+    printf_yellow(" Testing the buddy backend ---> ");
+    struct mem_pool_options options = {.backend = MEM_BACKEND_BUDDY};
+    mem_init_ex(3072, &options);
+    struct mem_stats stats;
+    mem_stats(&stats);
+    my_assert(stats.free_blocks == 2 && stats.largest_free == 2048); // 2048 + 1024
+
+    // Blocks are rounded up to a power of two and buddies merge back on free
+    char *base = mem_alloc(0);
+    char *a = mem_alloc(100);
+    char *b = mem_alloc(100);
+    my_assert(a == base + 2048 && b == a + 128 && mem_usable_size(a) == 128); // Split from the smaller block
+    mem_free(a);
+    mem_free(b);
+    mem_stats(&stats);
+    my_assert(stats.free_blocks == 2 && stats.largest_free == 2048);
+
+    void *c = mem_alloc_aligned(16, 1024);
+    my_assert(c != NULL && (uintptr_t)c % 1024 == 0);
+    mem_free(c);
+
+    // Resizing absorbs a free buddy or splits in place, and moves otherwise
+    char *x = mem_alloc(64);
+    my_assert(mem_resize(x, 128) == x && mem_usable_size(x) == 128);
+    my_assert(mem_resize(x, 16) == x && mem_usable_size(x) == 16);
+    char *y = mem_alloc(16);
+    memset(x, 0x5a, 16);
+    char *moved = mem_resize(x, 64);
+    my_assert(moved != x && moved[15] == 0x5a);
+    struct mem_resize_stats resize_stats;
+    mem_resize_stats(&resize_stats);
+    my_assert(resize_stats.in_place_grows == 1 && resize_stats.in_place_shrinks == 1 && resize_stats.moves == 1);
+    mem_free(moved);
+    mem_free(y);
+
+    // The pool fills exactly and drains back to its initial blocks
+    void *big = mem_alloc(2048);
+    void *half = mem_alloc(1024);
+    my_assert(big && half && mem_alloc(16) == NULL);
+    mem_free(big);
+    mem_free(half);
+    void *blocks[10];
+    my_assert(mem_alloc_batch(48, 10, blocks) == 10);
+    mem_free_batch(blocks, 10);
+    mem_stats(&stats);
+    my_assert(stats.free_bytes == 3072 && stats.free_blocks == 2 && stats.used_blocks == 0);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+void test_handle_compaction()
+{
+    printf_yellow(" Testing handles and compaction ---> ");
+    mem_init(816); // Three handle blocks of 256 bytes plus a 16-byte header each
+
+    // The fragmentation of test_non_contiguous_allocation_failure, but with handles
+    mem_handle_t h1 = mem_handle_alloc(250);
+    mem_handle_t h2 = mem_handle_alloc(250);
+    mem_handle_t h3 = mem_handle_alloc(250);
+    my_assert(h1 != MEM_HANDLE_NONE && h2 != MEM_HANDLE_NONE && h3 != MEM_HANDLE_NONE);
+    char *data = mem_handle_pin(h2);
+    memset(data, 0x77, 250);
+    mem_handle_unpin(h2);
+    mem_handle_free(h1);
+    mem_handle_free(h3);
+    my_assert(mem_alloc(500) == NULL);
+
+    // A pinned block stays put
+    char *pinned = mem_handle_pin(h2);
+    my_assert(pinned == data);
+    my_assert(!mem_compact(1000000));
+    my_assert(mem_handle_pin(h2) == data);
+    mem_handle_unpin(h2);
+    mem_handle_unpin(h2);
+
+    // Unpinned, it slides down and the free space becomes one extent
+    int steps = 0;
+    while (mem_compact(0))
+    {
+        steps++;
+    }
+    my_assert(steps >= 1);
+    data = mem_handle_pin(h2);
+    my_assert(data == (char *)mem_alloc(0) + 16 && data[0] == 0x77 && data[249] == 0x77);
+    mem_handle_unpin(h2);
+    void *big = mem_alloc(500);
+    my_assert(big != NULL);
+
+    // Ordinary blocks are never moved, and a freed handle is rejected
+    mem_handle_free(h2);
+    my_assert(mem_handle_pin(h2) == NULL);
+    mem_handle_t h4 = mem_handle_alloc(16);
+    my_assert(h4 != MEM_HANDLE_NONE);
+    my_assert(!mem_compact(1000000));
+    my_assert(mem_usable_size(big) == 512);
+    mem_handle_free(h4);
+    mem_free(big);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+#define SHARD_TEST_THREADS 4
+
+void *shard_test_worker(void *arg)
+{
+    void **blocks = arg;
+    for (int i = 0; i < 8; i++)
+    {
+        blocks[i] = mem_alloc(64);
+        my_assert(blocks[i] != NULL);
+    }
+    return NULL;
+}
+
+void test_sharded_pool()
+{
+    printf_yellow(" Testing sharded pools ---> ");
+    struct mem_pool_options options = {.shards = 4};
+    mem_init_ex(16384, &options); // Four shards of 4096 bytes
+    char *base = mem_alloc(0);
+    struct mem_stats stats;
+    mem_stats(&stats);
+    my_assert(stats.chunks == 4 && stats.pool_bytes == 16384 && stats.free_bytes == 16384);
+
+    // Consecutive threads get different home shards
+    pthread_t threads[SHARD_TEST_THREADS];
+    void *blocks[SHARD_TEST_THREADS][8];
+    for (int t = 0; t < SHARD_TEST_THREADS; t++)
+    {
+        pthread_create(&threads[t], NULL, shard_test_worker, blocks[t]);
+    }
+    bool used[SHARD_TEST_THREADS] = {false};
+    for (int t = 0; t < SHARD_TEST_THREADS; t++)
+    {
+        pthread_join(threads[t], NULL);
+        int shard = ((char *)blocks[t][0] - base) / 4096;
+        my_assert(!used[shard] && ((char *)blocks[t][7] - base) / 4096 == shard);
+        used[shard] = true;
+    }
+    // Frees from another thread go straight to the owning shard
+    for (int t = 0; t < SHARD_TEST_THREADS; t++)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            mem_free(blocks[t][i]);
+        }
+    }
+
+    // A full home shard spills over to its neighbours; nothing spans two shards
+    void *big[4];
+    for (int i = 0; i < 4; i++)
+    {
+        big[i] = mem_alloc(3000);
+        my_assert(big[i] != NULL && mem_owns(big[i]));
+    }
+    my_assert(mem_alloc(3000) == NULL && mem_alloc(5000) == NULL);
+    memset(big[0], 0x3c, 3000);
+    mem_free(big[1]);
+    void *filler = mem_alloc(1000); // Takes the rest of the home shard, after big[0]
+    char *moved = mem_resize(big[0], 4000);
+    my_assert(moved == big[1] && moved[2999] == 0x3c && !mem_owns(big[0]));
+    mem_free(filler);
+    mem_free(moved);
+    mem_free(big[2]);
+    mem_free(big[3]);
+    mem_stats(&stats);
+    my_assert(stats.free_bytes == 16384 && stats.used_blocks == 0 && stats.free_blocks == 4);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+// Dumps the default pool's heap profile and returns the sample count from its header
+static size_t profile_samples(char *text, size_t length)
+{
+    FILE *file = tmpfile();
+    my_assert(mem_profile_dump(fileno(file)) == 0);
+    rewind(file);
+    size_t read = fread(text, 1, length - 1, file);
+    text[read] = '\0';
+    fclose(file);
+    size_t count = 0;
+    size_t bytes = 0;
+    my_assert(sscanf(text, "heap profile: %zu: %zu [", &count, &bytes) == 2);
+    my_assert(strstr(text, "MAPPED_LIBRARIES:") != NULL);
+    return count;
+}
+
+void test_allocation_profiler()
+{
+    printf_yellow(" Testing the allocation profiler ---> ");
+    mem_init(1024 * 1024);
+    my_assert(mem_profile_dump(1) == -1); // Never profiled
+
+    // About one sample per KB: 200 blocks of 256 bytes give dozens
+    static char text[64 * 1024];
+    void *blocks[200];
+    mem_profile_set_rate(1024);
+    for (int i = 0; i < 200; i++)
+    {
+        blocks[i] = mem_alloc(256);
+    }
+    size_t samples = profile_samples(text, sizeof(text));
+    my_assert(samples >= 10 && samples <= 200);
+    my_assert(strstr(text, "@ heap_v2/1024") != NULL && strstr(text, "1: 256 [1: 256] @ 0x") != NULL);
+
+    // Once stopped, no new samples are taken, but the live ones follow their blocks
+    // through resizes and go away on free
+    mem_profile_set_rate(0);
+    for (int i = 0; i < 100; i++)
+    {
+        blocks[i] = mem_resize(blocks[i], 4096);
+    }
+    my_assert(profile_samples(text, sizeof(text)) == samples);
+    for (int i = 0; i < 200; i++)
+    {
+        mem_free(blocks[i]);
+    }
+    my_assert(profile_samples(text, sizeof(text)) == 0);
+    for (int i = 0; i < 200; i++)
+    {
+        blocks[i] = mem_alloc(256);
+    }
+    my_assert(profile_samples(text, sizeof(text)) == 0);
+    mem_free_batch(blocks, 200);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+// Runs a shell command with the interposer preloaded, expecting it to succeed
+static int run_preloaded(const char *command)
+{
+    char line[512];
+    snprintf(line, sizeof(line), "LD_PRELOAD=\"$PWD/libmemory_manager_preload.so\" sh -c '%s' > /dev/null 2>&1", command);
+    return system(line);
+}
+
+void test_preload_interposer()
+{
+    printf_yellow(" Testing the LD_PRELOAD interposer ---> ");
+    FILE *library = fopen("libmemory_manager_preload.so", "r");
+    my_assert(library != NULL); // Built by make all
+    fclose(library);
+
+    // Pipelines fork and exec through the interposer; parallel sort allocates from
+    // several threads and checks the result itself
+    my_assert(run_preloaded("ls /usr /etc | sort | wc -l") == 0);
+    my_assert(run_preloaded("test \"$(seq 1 100000 | sort -R --parallel=4 | sort -n --parallel=4 | tail -1)\" = 100000") == 0);
+    my_assert(run_preloaded("MEM_PRELOAD_SHARDS=1 MEM_PRELOAD_SIZE=67108864 sort -r /etc/passwd | wc -c") == 0);
+    printf_green("[PASS].\n");
+}
+
+void *trace_test_worker(void *arg)
+{
+    return mem_alloc(48);
+}
+
+void test_allocation_trace()
+{
+    printf_yellow(" Testing allocation traces ---> ");
+    mem_init(64 * 1024);
+    my_assert(mem_trace_stop() == -1); // Never started
+    void *before = mem_alloc(32);
+    char path[] = "/tmp/mem_trace_XXXXXX";
+    int fd = mkstemp(path);
+    my_assert(fd >= 0);
+    my_assert(mem_trace_start(fd) == 0);
+    my_assert(mem_trace_start(fd) == -1); // Already recording
+
+    // Blocks allocated before the trace are left out; resizes keep the block's id
+    void *a = mem_alloc(100);
+    void *b = mem_alloc_aligned(256, 64);
+    mem_free(before);
+    a = mem_resize(a, 1000);
+    pthread_t thread;
+    void *c;
+    pthread_create(&thread, NULL, trace_test_worker, NULL);
+    pthread_join(thread, &c);
+    mem_free(c);
+    mem_free(a);
+    my_assert(mem_trace_stop() == 0);
+    mem_free(b); // After the trace
+
+    struct
+    {
+        uint8_t op;
+        uint32_t id;
+        uint64_t size;
+    } expected[] = {
+        {MEM_TRACE_ALLOC, 1, 100}, {MEM_TRACE_ALLOC, 2, 256}, {MEM_TRACE_RESIZE, 1, 1000},
+        {MEM_TRACE_ALLOC, 3, 48}, {MEM_TRACE_FREE, 3, 0}, {MEM_TRACE_FREE, 1, 0},
+    };
+    struct mem_trace_header header;
+    struct mem_trace_record records[8];
+    my_assert(pread(fd, &header, sizeof(header), 0) == sizeof(header));
+    my_assert(memcmp(header.magic, MEM_TRACE_MAGIC, 8) == 0 && header.record_size == sizeof(records[0]));
+    my_assert(pread(fd, records, sizeof(records), sizeof(header)) == 6 * sizeof(records[0]));
+    for (int i = 0; i < 6; i++)
+    {
+        my_assert(records[i].op == expected[i].op && records[i].id == expected[i].id && records[i].size == expected[i].size);
+        my_assert(i == 0 || records[i].time_ns >= records[i - 1].time_ns);
+    }
+    my_assert(records[1].align_log2 == 6 && records[0].align_log2 == 0);
+    my_assert(records[3].thread != records[0].thread && records[4].thread == records[0].thread);
+    close(fd);
+    mem_deinit();
+
+    // The replay tool accepts the trace, on one thread and on the recorded ones
+    char command[128];
+    snprintf(command, sizeof(command), "./mem_replay --format csv %s > /dev/null", path);
+    my_assert(system(command) == 0);
+    snprintf(command, sizeof(command), "./mem_replay --single --allocator mem_buddy %s > /dev/null", path);
+    my_assert(system(command) == 0);
+    unlink(path);
+    printf_green("[PASS].\n");
+}
+
+void test_arena_allocator()
+{
+    printf_yellow(" Testing arenas ---> ");
+    mem_init(64 * 1024);
+    mem_arena_t *arena = mem_arena_begin(1024);
+    my_assert(arena != NULL);
+    my_assert(mem_arena_alloc(arena, 0) == NULL);
+
+    // Objects are bumped back to back, and the arena grows by a chunk once full
+    char *first = mem_arena_alloc(arena, 10);
+    char *second = mem_arena_alloc(arena, 100);
+    my_assert(first && second && second - first == 16);
+    char *objects[100];
+    for (int i = 0; i < 100; i++)
+    {
+        objects[i] = mem_arena_alloc(arena, 48);
+        my_assert(objects[i] != NULL && (uintptr_t)objects[i] % MEM_ALIGN_DEFAULT == 0);
+        memset(objects[i], i, 48);
+    }
+    for (int i = 0; i < 100; i++)
+    {
+        my_assert(objects[i][47] == (char)i);
+    }
+    char *large = mem_arena_alloc(arena, 8000); // Larger than the next chunk
+    my_assert(large != NULL);
+    memset(large, 0x5a, 8000);
+
+    // A reset hands out the same memory again, in the same order
+    struct mem_stats before, after;
+    mem_stats(&before);
+    mem_arena_reset(arena);
+    my_assert(mem_arena_alloc(arena, 10) == first);
+    my_assert(mem_arena_alloc(arena, 100) == second);
+    for (int i = 0; i < 100; i++)
+    {
+        my_assert(mem_arena_alloc(arena, 48) == objects[i]);
+    }
+    my_assert(mem_arena_alloc(arena, 8000) == large);
+    mem_stats(&after);
+    my_assert(after.used_bytes == before.used_bytes && after.allocs == before.allocs);
+
+    // Ending the arena gives every chunk back to the pool
+    mem_arena_end(arena);
+    void *whole = mem_alloc(64 * 1024);
+    my_assert(whole != NULL);
+    mem_free(whole);
+    my_assert(mem_arena_begin(128 * 1024) == NULL);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+// Reference for the free-run kernels: first start of n set bits, one bit at a time
+static uint32_t bitmap_reference_run(const uint64_t *map, uint32_t words, uint32_t n)
+{
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < words * 64; i++)
+    {
+        run = (map[i / 64] >> (i % 64) & 1) ? run + 1 : 0;
+        if (run == n)
+        {
+            return i + 1 - n;
+        }
+    }
+    return MEM_BITMAP_NONE;
+}
+
+void test_bitmap_backend()
+{
+    printf_yellow(" Testing the bitmap backend ---> ");
+
+    // Every kernel the CPU supports agrees with the reference on random maps of
+    // varying density, including runs across words and past the SIMD blocks
+    enum mem_bitmap_kernel picked = mem_bitmap_kernel();
+    const uint32_t lengths[] = {1, 2, 3, 7, 17, 33, 34, 48, 63, 64, 65, 100, 200};
+    uint64_t map[37];
+    uint64_t rng = 12345;
+    for (int kernel = MEM_BITMAP_SCALAR; kernel <= MEM_BITMAP_AVX2; kernel++)
+    {
+        if (!mem_bitmap_set_kernel(kernel))
+        {
+            continue;
+        }
+        for (int round = 0; round < 300; round++)
+        {
+            for (int i = 0; i < 37; i++)
+            {
+                rng ^= rng << 13;
+                rng ^= rng >> 7;
+                rng ^= rng << 17;
+                uint64_t bits = rng;
+                for (int density = round % 4; density > 0; density--)
+                {
+                    // Thins out the free bits, or on odd rounds fills them in
+                    bits = (round & 1) ? bits | (bits >> 1 | bits << 63) : bits & (bits >> 1 | bits << 63);
+                }
+                map[i] = (round % 5 == 0 && i % 3 == 0) ? ~0ULL : (round % 7 == 0 && i < 30) ? 0 : bits;
+            }
+            for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+            {
+                my_assert(mem_bitmap_find_run(map, 37, lengths[l]) == bitmap_reference_run(map, 37, lengths[l]));
+            }
+        }
+    }
+    my_assert(mem_bitmap_set_kernel(picked));
+
+    // Bitmap pools place blocks first fit by address and coalesce on free
+    struct mem_pool_options options = {.backend = MEM_BACKEND_BITMAP};
+    mem_init_ex(4096, &options);
+    char *a = mem_alloc(100);
+    char *b = mem_alloc(16);
+    char *c = mem_alloc(200);
+    my_assert(a && b == a + 112 && c == b + 16);
+    mem_free(a);
+    char *d = mem_alloc(200);
+    my_assert(d == c + 208);         // The hole of 112 bytes is too small
+    my_assert(mem_alloc(96) == a);   // But fits a smaller block
+    struct mem_stats stats;
+    mem_stats(&stats);
+    my_assert(stats.free_blocks == 2 && stats.largest_free == 4096 - 2 * 208 - 112 - 16);
+
+    void *aligned = mem_alloc_aligned(16, 1024);
+    my_assert(aligned != NULL && (uintptr_t)aligned % 1024 == 0);
+    mem_free(aligned);
+
+    // Resizing grows into a free neighbour in place and moves otherwise
+    char *moved = mem_resize(b, 32);
+    my_assert(moved != b && moved > d);
+    mem_free(c);
+    my_assert(mem_resize(a, 112 + 16 + 208) == a);
+    mem_free(a);
+    mem_free(d);
+    mem_free(moved);
+    mem_stats(&stats);
+    my_assert(stats.free_bytes == 4096 && stats.free_blocks == 1 && stats.used_blocks == 0);
+
+    // The pool fills exactly and drains back to one free block
+    void *blocks[64];
+    my_assert(mem_alloc_batch(64, 64, blocks) == 64);
+    my_assert(mem_alloc(16) == NULL);
+    mem_free_batch(blocks, 64);
+    void *whole = mem_alloc(4096);
+    my_assert(whole != NULL);
+    mem_free(whole);
+    mem_stats(&stats);
+    my_assert(stats.free_bytes == 4096 && stats.free_blocks == 1 && stats.used_blocks == 0);
+    mem_deinit();
+
+    // Once a search finds the map full, freed blocks still open it up again, and the
+    // largest free block follows every change
+    mem_init_ex(64 * 1024, &options);
+    char *filled[512];
+    for (int i = 0; i < 512; i++)
+    {
+        filled[i] = mem_alloc(128);
+        my_assert(filled[i] != NULL);
+    }
+    my_assert(mem_alloc(16) == NULL);
+    mem_free(filled[10]);
+    my_assert(mem_alloc(128) == filled[10]);
+    mem_free(filled[300]);
+    mem_free(filled[301]);
+    mem_stats(&stats);
+    my_assert(stats.largest_free == 256);
+    my_assert(mem_alloc(256) == filled[300]);
+    mem_stats(&stats);
+    my_assert(stats.largest_free == 0);
+    mem_free(filled[511]);
+    mem_stats(&stats);
+    my_assert(stats.largest_free == 128);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+#define LOCK_TEST_THREADS 4
+#define LOCK_TEST_ROUNDS 5000
+
+void *lock_test_worker(void *arg)
+{
+    mem_pool_t *pool = arg;
+    unsigned char *blocks[8] = {NULL};
+    for (int i = 0; i < LOCK_TEST_ROUNDS; i++)
+    {
+        int slot = i % 8;
+        if (blocks[slot])
+        {
+            // A block handed to two threads at once would show the other's pattern
+            for (int j = 0; j < 48; j++)
+            {
+                my_assert(blocks[slot][j] == (unsigned char)(size_t)blocks[slot]);
+            }
+            mem_pool_free(pool, blocks[slot]);
+        }
+        blocks[slot] = mem_pool_alloc(pool, 48);
+        my_assert(blocks[slot] != NULL);
+        memset(blocks[slot], (unsigned char)(size_t)blocks[slot], 48);
+    }
+    for (int slot = 0; slot < 8; slot++)
+    {
+        mem_pool_free(pool, blocks[slot]);
+    }
+    return NULL;
+}
+
+struct lock_order
+{
+    mem_lock_t *lock;
+    int arrived;
+    int served;
+    int order[LOCK_TEST_THREADS];
+};
+
+struct lock_order_arg
+{
+    struct lock_order *shared;
+    int id;
+};
+
+void *lock_order_worker(void *arg)
+{
+    struct lock_order_arg *self = arg;
+    __atomic_fetch_add(&self->shared->arrived, 1, __ATOMIC_RELEASE);
+    mem_lock_acquire(self->shared->lock);
+    self->shared->order[self->shared->served++] = self->id;
+    mem_lock_release(self->shared->lock);
+    return NULL;
+}
+
+void test_lock_kinds()
+{
+    printf_yellow(" Testing pool lock kinds ---> ");
+    for (int kind = MEM_LOCK_PTHREAD; kind <= MEM_LOCK_ADAPTIVE; kind++)
+    {
+        // Threads hammering one lock never share a block, and every acquisition counts
+        struct mem_pool_options options = {.lock = kind};
+        mem_pool_t *pool = mem_pool_create_ex(65536, &options);
+        pthread_t threads[LOCK_TEST_THREADS];
+        for (int t = 0; t < LOCK_TEST_THREADS; t++)
+        {
+            pthread_create(&threads[t], NULL, lock_test_worker, pool);
+        }
+        for (int t = 0; t < LOCK_TEST_THREADS; t++)
+        {
+            pthread_join(threads[t], NULL);
+        }
+        struct mem_stats stats;
+        mem_pool_stats(pool, &stats);
+        my_assert(stats.used_blocks == 0 && stats.free_blocks == 1);
+        my_assert(stats.lock_acquires >= LOCK_TEST_THREADS * LOCK_TEST_ROUNDS * 2);
+        my_assert(stats.lock_contentions <= stats.lock_acquires);
+        my_assert(stats.lock_contentions > 0 || stats.lock_wait_ns == 0);
+        mem_pool_destroy(pool);
+
+        // A thread may hold the locks of every shard at once, as fork handlers do
+        options.shards = 4;
+        pool = mem_pool_create_ex(16384, &options);
+        mem_pool_lock_all(pool);
+        mem_pool_unlock_all(pool);
+        void *block = mem_pool_alloc(pool, 64);
+        my_assert(block != NULL);
+        mem_pool_free(pool, block);
+        mem_pool_stats(pool, &stats);
+        my_assert(stats.lock_acquires >= 4 + 2);
+        mem_pool_destroy(pool);
+
+        // Ticket and MCS locks go to their waiters in arrival order
+        if (kind != MEM_LOCK_TICKET && kind != MEM_LOCK_MCS)
+        {
+            continue;
+        }
+        struct lock_order order = {.lock = mem_lock_create(kind)};
+        struct lock_order_arg args[LOCK_TEST_THREADS];
+        mem_lock_acquire(order.lock);
+        for (int t = 0; t < LOCK_TEST_THREADS; t++)
+        {
+            args[t] = (struct lock_order_arg){&order, t};
+            pthread_create(&threads[t], NULL, lock_order_worker, &args[t]);
+            while (__atomic_load_n(&order.arrived, __ATOMIC_ACQUIRE) <= t)
+            {
+                usleep(1000);
+            }
+            usleep(20000); // Time to join the queue
+        }
+        mem_lock_release(order.lock);
+        for (int t = 0; t < LOCK_TEST_THREADS; t++)
+        {
+            pthread_join(threads[t], NULL);
+        }
+        my_assert(order.served == LOCK_TEST_THREADS);
+        for (int t = 0; t < LOCK_TEST_THREADS; t++)
+        {
+            my_assert(order.order[t] == t);
+        }
+        struct mem_lock_stats lock_stats;
+        mem_lock_stats(order.lock, &lock_stats);
+        my_assert(lock_stats.acquires == LOCK_TEST_THREADS + 2 && lock_stats.contentions >= LOCK_TEST_THREADS);
+        mem_lock_destroy(order.lock);
+    }
+    printf_green("[PASS].\n");
+}
+
 int main(int argc, char *argv[])
 {
 #ifdef VERSION
@@ -354,6 +1796,31 @@ int main(int argc, char *argv[])
         printf(" 14. test_block_merging - Test merging of adjacent free blocks\n");
         printf(" 15. test_non_contiguous_allocation_failure - Ensure failure when no contiguous block fits\n");
         printf(" 16. test_contiguous_allocation_success - Ensure success when a contiguous block fits\n");
+        printf("\nAllocator Features:\n");
+        printf(" 19. test_size_class_reuse - Test that freed holes are reused by size class\n");
+        printf(" 20. test_resize_preserves_data - Test that data survives neighbour frees and moving resizes\n");
+        printf(" 21. test_owns_and_usable_size - Test pointer ownership and usable size queries\n");
+        printf(" 22. test_thread_cache - Test per-thread caches of small freed blocks\n");
+        printf(" 23. test_independent_pools - Test pool handles alongside the default pool\n");
+        printf(" 24. test_resize_in_place - Test in-place growth and shrinking in mem_resize\n");
+        printf(" 25. test_slab_allocator - Test the fixed-size slab allocator\n");
+        printf(" 26. test_aligned_allocation - Test aligned allocation and a pool-wide minimum alignment\n");
+        printf(" 27. test_batch_allocation - Test batch allocation and deallocation\n");
+        printf(" 28. test_lock_free_region - Test lock-free bump regions and lock-free pools\n");
+        printf(" 29. test_allocator_stats - Test allocator statistics and fragmentation reporting\n");
+        printf(" 30. test_placement_policies - Test segregated, next-fit and best-fit placement\n");
+        printf(" 31. test_mmap_backing - Test mmap-backed pools with huge pages\n");
+        printf(" 32. test_growable_pool - Test growable pools that chain extra chunks\n");
+        printf(" 33. test_file_backed_pool - Test file-backed pools that persist across reopening\n");
+        printf(" 34. test_buddy_backend - Test the buddy allocator backend\n");
+        printf(" 35. test_handle_compaction - Test relocatable handles and online compaction\n");
+        printf(" 36. test_sharded_pool - Test sharded pools with a lock per address range\n");
+        printf(" 37. test_allocation_profiler - Test the sampling allocation profiler\n");
+        printf(" 38. test_preload_interposer - Test running programs on the LD_PRELOAD interposer\n");
+        printf(" 39. test_allocation_trace - Test recording and replaying an allocation trace\n");
+        printf(" 40. test_arena_allocator - Test scoped arenas with bulk reset\n");
+        printf(" 41. test_bitmap_backend - Test the bitmap backend and its SIMD kernels\n");
+        printf(" 42. test_lock_kinds - Test the pthread, ticket, MCS and adaptive pool locks\n");
         printf(" 0. Run all tests\n");
         return 1;
     }
@@ -387,6 +1854,32 @@ int main(int argc, char *argv[])
         test_non_contiguous_allocation_failure();
         test_contiguous_allocation_success();
 
+        printf("\nTesting Allocator Features:\n");
+        test_size_class_reuse();
+        test_resize_preserves_data();
+        test_owns_and_usable_size();
+        test_thread_cache();
+        test_independent_pools();
+        test_resize_in_place();
+        test_slab_allocator();
+        test_aligned_allocation();
+        test_batch_allocation();
+        test_lock_free_region();
+        test_allocator_stats();
+        test_placement_policies();
+        test_mmap_backing();
+        test_growable_pool();
+        test_file_backed_pool();
+        test_buddy_backend();
+        test_handle_compaction();
+        test_sharded_pool();
+        test_allocation_profiler();
+        test_preload_interposer();
+        test_allocation_trace();
+        test_arena_allocator();
+        test_bitmap_backend();
+        test_lock_kinds();
+
         printf("\nVarious other tests:\n");
         test_zero_alloc_and_free();
         test_random_blocks();
@@ -445,18 +1938,81 @@ int main(int argc, char *argv[])
     case 18:
         test_random_blocks();
         break;
+    case 19:
+        test_size_class_reuse();
+        break;
+    case 20:
+        test_resize_preserves_data();
+        break;
+    case 21:
+        test_owns_and_usable_size();
+        break;
+    case 22:
+        test_thread_cache();
+        break;
+    case 23:
+        test_independent_pools();
+        break;
+    case 24:
+        test_resize_in_place();
+        break;
+    case 25:
+        test_slab_allocator();
+        break;
+    case 26:
+        test_aligned_allocation();
+        break;
+    case 27:
+        test_batch_allocation();
+        break;
+    case 28:
+        test_lock_free_region();
+        break;
+    case 29:
+        test_allocator_stats();
+        break;
+    case 30:
+        test_placement_policies();
+        break;
+    case 31:
+        test_mmap_backing();
+        break;
+    case 32:
+        test_growable_pool();
+        break;
+    case 33:
+        test_file_backed_pool();
+        break;
+    case 34:
+        test_buddy_backend();
+        break;
+    case 35:
+        test_handle_compaction();
+        break;
+    case 36:
+        test_sharded_pool();
+        break;
+    case 37:
+        test_allocation_profiler();
+        break;
+    case 38:
+        test_preload_interposer();
+        break;
+    case 39:
+        test_allocation_trace();
+        break;
+    case 40:
+        test_arena_allocator();
+        break;
+    case 41:
+        test_bitmap_backend();
+        break;
+    case 42:
+        test_lock_kinds();
+        break;
     default:
         printf("Invalid test function\n");
         break;
     }
     return 0;
 }
-void test_exceed_single_allocation()
-{
-    printf_yellow(" Testing allocation exceeding pool size ---> ");
-    mem_init(1024);                // Initialize with 1KB of memory
-    void *block = mem_alloc(2048); // Try allocating more than available
-    my_assert(block == NULL);      // Allocation should fail
-    mem_deinit();
-    printf_green("[PASS].\n");
-}
\ No newline at end of file